@@ -0,0 +1,240 @@
+#include "heap.h"
+#include "rbtree.h"
+#include "freelist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// drives each free index backend directly with synthetic operation mixes
+// blocks are laid out back to back in an arena like a real heap, with payload sizes from 16 to 512 bytes
+// (weighted towards small sizes), and every block starts out in the index
+// each mix runs in doubling batches until it has taken BENCH_MIN_NS, so slow backends still finish
+// usage: bench [max free blocks], the default sweep is 1e3 to 1e6
+
+#define BENCH_DEFAULT_MAX 1000000
+#define BENCH_MIN_NS 200000000
+#define BENCH_MAX_OPS 4000000
+#define BENCH_MAX_SIZE 512
+
+typedef struct {
+    const char* name;
+    void (*put)(BlockNode* node);
+    void (*delete)(BlockNode* node);
+    // a block for a payload of size, like BestFreeBlock in ymalloc.c
+    BlockNode* (*find)(size_t size);
+} Backend;
+
+static BlockNode* root = NULL;
+
+static void RBPut(BlockNode* node) {
+    RB_NODE_SET_LEFT(node, NULL);
+    RB_NODE_SET_RIGHT(node, NULL);
+    RB_Put(&root, node);
+}
+static void RBDelete(BlockNode* node) { RB_Delete(&root, node); }
+static BlockNode* RBFind(size_t size) { return RB_Ceiling(root, size + BLOCK_MIN_SIZE); }
+
+static void FLPut(BlockNode* node) { FL_Put(&root, node); }
+static void FLDelete(BlockNode* node) { FL_Delete(&root, node); }
+static BlockNode* FLFind(size_t size) { return FL_BestFit(root, size); }
+
+static const Backend backends[] = {
+    { "rbtree",   RBPut, RBDelete, RBFind },
+    { "freelist", FLPut, FLDelete, FLFind },
+};
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t Rand(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+// log uniform, so most blocks are small like in a typical heap
+static size_t RandSize(size_t max) {
+    size_t bits = 4 + Rand() % 6;
+    size_t size = (size_t) 1 << bits;
+    size += Rand() % size;
+    if (size > max)
+        size = max;
+    return HEAP_ALIGN_UP(size);
+}
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// -1 if the kernel or sandbox doesn't allow hardware counters
+static int OpenCacheMisses(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t ReadCounter(int fd) {
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != (ssize_t) sizeof(value))
+        return 0;
+    return value;
+}
+
+// keeps results alive, so the compiler can't drop the searches
+static volatile uint64_t sink = 0;
+
+static BlockNode** blocks = NULL;
+static size_t* capacity = NULL;
+static size_t numBlocks = 0;
+
+static BlockSize* Header(BlockNode* node) {
+    return (BlockSize*) (((uint8_t*) node) - BLOCK_HEADER_SIZE);
+}
+
+// only the header matters to the index, the footer is written to touch the same memory a heap would
+static BlockNode* MakeFreeBlock(uint8_t* ptr, size_t size) {
+    *(BlockSize*) ptr = size | BLOCK_FREE;
+    *(BlockSize*) (ptr + BLOCK_HEADER_SIZE + size) = size | BLOCK_FREE;
+    return (BlockNode*) (ptr + BLOCK_HEADER_SIZE);
+}
+
+// lays out n blocks in the arena, returns false if it can't be mapped
+static bool BuildArena(size_t n, uint8_t** arena, size_t* arenaSize) {
+    *arenaSize = n * (BENCH_MAX_SIZE + BLOCK_AUXILIARY_SIZE);
+    *arena = mmap(NULL, *arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (*arena == MAP_FAILED)
+        return false;
+    // the index links are offsets from the heap base, which is the arena here (the allocator itself is never called)
+    yheapBase = *arena;
+    blocks = malloc(n * sizeof(BlockNode*));
+    capacity = malloc(n * sizeof(size_t));
+    uint8_t* curr = *arena;
+    for (size_t i = 0; i < n; ++i) {
+        size_t size = RandSize(BENCH_MAX_SIZE);
+        blocks[i] = MakeFreeBlock(curr, size);
+        capacity[i] = size;
+        curr += size + BLOCK_AUXILIARY_SIZE;
+    }
+    numBlocks = n;
+    return true;
+}
+
+static void FreeArena(uint8_t* arena, size_t arenaSize) {
+    munmap(arena, arenaSize);
+    free(blocks);
+    free(capacity);
+}
+
+// gives a block a new size that still fits where it was laid out
+static void Resize(size_t i) {
+    *Header(blocks[i]) = RandSize(capacity[i]) | BLOCK_FREE;
+}
+
+typedef enum {
+    MIX_BASELINE, // picks a random block and reads its header, the overhead included in the other mixes
+    MIX_FIND,     // best fit searches for random sizes
+    MIX_CHURN,    // deletes a random block and puts it back with a new size
+    MIX_ALLOC,    // finds and deletes a fit, then puts it back, like a malloc and free
+    MIX_COUNT,
+} Mix;
+
+static const char* mixNames[] = { "baseline", "find", "delete+put", "find+delete+put" };
+
+// returns the number of index operations done
+static size_t RunBatch(const Backend* backend, Mix mix, size_t batch) {
+    size_t ops = 0;
+    for (size_t b = 0; b < batch; ++b) {
+        size_t i = Rand() % numBlocks;
+        switch (mix) {
+        case MIX_BASELINE:
+            sink += *Header(blocks[i]);
+            break;
+        case MIX_FIND:
+            sink += (uintptr_t) backend->find(RandSize(BENCH_MAX_SIZE));
+            ops += 1;
+            break;
+        case MIX_CHURN:
+            backend->delete(blocks[i]);
+            Resize(i);
+            backend->put(blocks[i]);
+            ops += 2;
+            break;
+        case MIX_ALLOC: {
+            BlockNode* found = backend->find(RandSize(BENCH_MAX_SIZE / 2));
+            ops += 1;
+            if (found) {
+                backend->delete(found);
+                backend->put(found);
+                ops += 2;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    // the baseline counts each pick as an operation
+    return mix == MIX_BASELINE ? batch : ops;
+}
+
+static void RunMix(const Backend* backend, Mix mix, size_t n, int perfFd) {
+    size_t ops = 0;
+    ioctl(perfFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perfFd, PERF_EVENT_IOC_ENABLE, 0);
+    uint64_t t0 = NowNs();
+    uint64_t elapsed = 0;
+    for (size_t batch = 1; elapsed < BENCH_MIN_NS && ops < BENCH_MAX_OPS; batch *= 2) {
+        ops += RunBatch(backend, mix, batch);
+        elapsed = NowNs() - t0;
+    }
+    ioctl(perfFd, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t misses = ReadCounter(perfFd);
+
+    char missText[32] = "n/a";
+    if (perfFd >= 0)
+        snprintf(missText, sizeof(missText), "%.2f", (double) misses / (double) ops);
+    printf("%-10s %-16s %10zu %12zu %12.1f %14s\n",
+        backend->name, mixNames[mix], n, ops, (double) elapsed / (double) ops, missText);
+}
+
+int main(int argc, char** argv) {
+    size_t maxBlocks = argc > 1 ? (size_t) strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_MAX;
+    int perfFd = OpenCacheMisses();
+    if (perfFd < 0)
+        printf("cache misses are not available (perf_event_open failed)\n");
+
+    printf("%-10s %-16s %10s %12s %12s %14s\n", "backend", "mix", "blocks", "ops", "ns/op", "misses/op");
+    for (size_t n = 1000; n <= maxBlocks; n *= 10) {
+        for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+            uint8_t* arena;
+            size_t arenaSize;
+            if (!BuildArena(n, &arena, &arenaSize)) {
+                printf("can't map an arena for %zu blocks\n", n);
+                return 1;
+            }
+            // put in address order, as a heap that was freed front to back
+            root = NULL;
+            for (size_t i = 0; i < n; ++i)
+                backends[b].put(blocks[i]);
+            for (Mix mix = 0; mix < MIX_COUNT; ++mix)
+                RunMix(&backends[b], mix, n, perfFd);
+            FreeArena(arena, arenaSize);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/env ruby
+
+# reads a heap snapshot written by yheap_snapshot and prints fragmentation statistics
+
+filename = ARGV[0]
+if filename.nil?
+    puts "Usage: snapshot.rb <snapshotfile>"
+    exit(1)
+end
+
+HEADER_SIZE = 48
+BLOCK_AUXILIARY_SIZE = 16
+PAGE_SIZE = 4096
+
+data = File.binread(filename)
+magic, base, heapsize, blockcount, freecount, indexkind = data.unpack("a8Q<Q<Q<Q<L<")
+if magic.delete("\0") != "YMSNAP1"
+    puts "ERROR: #{filename} is not a ymalloc snapshot"
+    exit(1)
+end
+
+headers = data.unpack("Q<#{blockcount}", offset: HEADER_SIZE)
+freeentries = data.unpack("Q<L<L<" * freecount, offset: HEADER_SIZE + 8*blockcount).each_slice(3).to_a
+
+usedbytes = 0
+freebytes = 0
+freesizes = []
+touchedpages = {}
+offset = 0
+headers.each { |header|
+    size = header & ~7
+    if (header & 1 == 1)
+        freebytes += size
+        freesizes.push size
+    else
+        usedbytes += size
+        # pages holding live data
+        ((base + offset) / PAGE_SIZE..(base + offset + size + BLOCK_AUXILIARY_SIZE - 1) / PAGE_SIZE).each { |page|
+            touchedpages[page] = true
+        }
+    end
+    offset += size + BLOCK_AUXILIARY_SIZE
+}
+
+largest = freesizes.max || 0
+depths = freeentries.map { |entry| entry[1] }
+
+puts "heap:             #{heapsize} bytes at 0x#{base.to_s(16)}"
+puts "blocks:           #{blockcount} (#{blockcount - freesizes.size} used, #{freesizes.size} free)"
+puts "used payload:     #{usedbytes} bytes"
+puts "free payload:     #{freebytes} bytes"
+puts "overhead:         #{blockcount * BLOCK_AUXILIARY_SIZE} bytes"
+puts "largest free:     #{largest} bytes"
+if (freebytes > 0)
+    puts "fragmentation:    #{(100.0 * (1 - largest.to_f / freebytes)).round(2)}% (1 - largest free / total free)"
+end
+puts "pages with data:  #{touchedpages.size} of #{(heapsize + PAGE_SIZE - 1) / PAGE_SIZE}"
+puts "free index:       #{indexkind == 0 ? "red black tree" : "linked list"}, #{freecount} nodes, " +
+    "max depth #{depths.max || 0}, mean depth #{depths.empty? ? 0 : (depths.sum.to_f / depths.size).round(2)}"
+
+# free block sizes by power of two
+puts "free block sizes:"
+histogram = freesizes.group_by { |size| size.bit_length - 1 }
+histogram.keys.sort.each { |bucket|
+    puts "  %10d - %-10d %d" % [1 << bucket, (2 << bucket) - 1, histogram[bucket].size]
+}
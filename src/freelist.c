@@ -0,0 +1,119 @@
+#include "freelist.h"
+#include <stdbool.h>
+#include <assert.h>
+#include <stdint.h>
+
+#define FL_NODE_SIZE(x) BLOCKSIZE_BYTES(*(BlockSize*)(((uint8_t*)(x)) - BLOCK_HEADER_SIZE))
+
+void FL_Put(BlockNode** head, BlockNode* toInsert) {
+#ifdef DEBUG
+    for (BlockNode* curr = *head;
+        curr != NULL;
+        curr = BlockLinkNode(curr->link[1]))
+    {
+        assert(curr != toInsert);
+    }
+#endif
+
+    // insert at front of the free list
+    toInsert->link[0] = 0;
+    toInsert->link[1] = BlockLinkOf(*head);
+    if (*head) {
+        assert((*head)->link[0] == 0);
+        (*head)->link[0] = BlockLinkOf(toInsert);
+    }
+    *head = toInsert;
+}
+
+void FL_Delete(BlockNode** head, BlockNode* toDelete) {
+#ifdef DEBUG
+    bool hasNode = false;
+    for (BlockNode* curr = *head;
+        curr != NULL;
+        curr = BlockLinkNode(curr->link[1]))
+    {
+        if (curr == toDelete) {
+            hasNode = true;
+            break;
+        }
+    }
+    assert(hasNode);
+#endif
+
+    BlockNode* prev = BlockLinkNode(toDelete->link[0]);
+    BlockNode* next = BlockLinkNode(toDelete->link[1]);
+    if (prev)
+        prev->link[1] = BlockLinkOf(next);
+    else
+        *head = next;
+    if (next)
+        next->link[0] = BlockLinkOf(prev);
+}
+
+BlockNode* FL_BestFit(BlockNode* head, size_t size) {
+    size_t sizeNeeded = size + BLOCK_MIN_SIZE;
+    BlockNode* best = NULL;
+    size_t leastWaste = SIZE_MAX;
+    for (BlockNode* curr = head;
+        curr != NULL;
+        curr = BlockLinkNode(curr->link[1]))
+    {
+        size_t blockSize = FL_NODE_SIZE(curr);
+
+        // exact fit
+        if (blockSize == size)
+            return curr;
+
+        // save the best fit that would split a block
+        if (blockSize >= sizeNeeded) {
+#if FL_FIRST_FIT
+            return curr;
+#else
+            if (leastWaste > blockSize - sizeNeeded) {
+                leastWaste = blockSize - sizeNeeded;
+                best = curr;
+            }
+#endif
+        }
+    }
+    return best;
+}
+
+BlockNode* FL_LowestFit(BlockNode* head, size_t size, BlockNode* below, uintptr_t align, int budget) {
+    BlockNode* best = NULL;
+    for (BlockNode* curr = head;
+        curr != NULL && budget > 0;
+        curr = BlockLinkNode(curr->link[1]), --budget)
+    {
+        size_t blockSize = FL_NODE_SIZE(curr);
+        bool fits = blockSize == size || blockSize >= size + BLOCK_MIN_SIZE;
+        if (fits && curr < below && ((uintptr_t) curr & (align - 1)) == 0 && (best == NULL || curr < best))
+            best = curr;
+    }
+    return best;
+}
+
+void FL_Walk(BlockNode* head, FreeIndexVisitor visit, void* arg) {
+    int depth = 0;
+    for (BlockNode* curr = head;
+        curr != NULL;
+        curr = BlockLinkNode(curr->link[1]))
+    {
+        visit(curr, depth++, arg);
+    }
+}
+
+size_t FL_WalkFrom(BlockNode* head, size_t skip, size_t minSize, int budget, FreeIndexVisitor visit, void* arg) {
+    size_t pos = 0;
+    for (BlockNode* curr = head;
+        curr != NULL;
+        curr = BlockLinkNode(curr->link[1]), ++pos)
+    {
+        if (pos < skip || FL_NODE_SIZE(curr) < minSize)
+            continue;
+        if (budget-- <= 0)
+            return pos;
+        visit(curr, (int) pos, arg);
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef FREELIST_H
+#define FREELIST_H
+
+#include "heap.h"
+#include <stdint.h>
+
+// doubly linked free list, link[0] is the previous node and link[1] the next
+// nodes are pushed at the front and searched linearly
+
+#define FL_FIRST_FIT 0
+
+void FL_Put(BlockNode** head, BlockNode* toInsert);
+void FL_Delete(BlockNode** head, BlockNode* toDelete);
+// a block of exactly size, or else the smallest (or first, with FL_FIRST_FIT) of at least size + BLOCK_MIN_SIZE
+BlockNode* FL_BestFit(BlockNode* head, size_t size);
+// the lowest addressed block below "below" that fits size like FL_BestFit and is aligned to align,
+// out of the first budget nodes of the list
+BlockNode* FL_LowestFit(BlockNode* head, size_t size, BlockNode* below, uintptr_t align, int budget);
+void FL_Walk(BlockNode* head, FreeIndexVisitor visit, void* arg);
+// visits the first budget nodes of at least minSize bytes past the first skip nodes of the list,
+// returns the position to carry on from, or 0 if the walk got to the end first
+size_t FL_WalkFrom(BlockNode* head, size_t skip, size_t minSize, int budget, FreeIndexVisitor visit, void* arg);
+
+
+#endif // FREELIST_H
@@ -0,0 +1,232 @@
+#include "guarded.h"
+#include "ymalloc.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+// the pool is a single mapping of alternating guard and data pages
+// | guard | slot 0 | guard | slot 1 | ... | slot n-1 | guard |
+// allocations are aligned to the end of their data page, so overflows hit the next guard page
+
+typedef enum {
+    SLOT_EMPTY = 0,
+    SLOT_ALLOCATED = 1,
+    SLOT_FREED = 2,
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    void* ptr;
+    size_t size;
+    int allocDepth;
+    int freeDepth;
+    void* allocTrace[GUARDED_MAX_FRAMES];
+    void* freeTrace[GUARDED_MAX_FRAMES];
+} GuardedSlot;
+
+uint32_t guardedCountdown = 0;
+uint8_t* guardedPoolBegin = NULL;
+uint8_t* guardedPoolEnd = NULL;
+
+static bool didInitPool = false;
+static uint32_t sampleRate = 0;
+static uint32_t rngState = 0x9E3779B9;
+static size_t pageSize = 0;
+static size_t nextSlot = 0;
+static GuardedSlot slots[GUARDED_NUM_SLOTS];
+static struct sigaction prevSegvAction;
+
+// uniform in [1, 2*rate-1], so one in every rate allocations is sampled on average
+// without aliasing with periodic allocation patterns
+static uint32_t NextCountdown(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    if (sampleRate <= 1)
+        return sampleRate;
+    return (uint32_t) (rngState % (2 * (uint64_t) sampleRate - 1) + 1);
+}
+
+static uint8_t* SlotPage(size_t idx) {
+    return guardedPoolBegin + (2*idx + 1) * pageSize;
+}
+
+// returns the slot whose data page contains ptr, or NULL for a guard page
+static GuardedSlot* SlotOf(void* ptr) {
+    size_t page = (size_t) ((uint8_t*) ptr - guardedPoolBegin) / pageSize;
+    if (page % 2 == 0)
+        return NULL;
+    return &slots[page / 2];
+}
+
+// only async-signal-safe calls from here (and backtrace_symbols_fd, which doesn't allocate),
+// this runs inside the fault handler, so numbers are formatted by hand instead of with snprintf
+static void WriteStr(const char* str) {
+    ssize_t n = write(STDERR_FILENO, str, strlen(str));
+    (void) n;
+}
+
+static void WriteNum(uintptr_t x, unsigned base) {
+    char buf[24];
+    char* curr = buf + sizeof(buf) - 1;
+    *curr = '\0';
+    do {
+        *--curr = "0123456789abcdef"[x % base];
+        x /= base;
+    } while (x != 0);
+    if (base == 16) {
+        *--curr = 'x';
+        *--curr = '0';
+    }
+    WriteStr(curr);
+}
+
+static void ReportSlot(const char* what, void* addr, GuardedSlot* slot) {
+    WriteStr("ymalloc: ");
+    WriteStr(what);
+    WriteStr(" at ");
+    WriteNum((uintptr_t) addr, 16);
+    WriteStr("\n");
+    if (slot == NULL || slot->state == SLOT_EMPTY)
+        return;
+    WriteStr("  guarded allocation ");
+    WriteNum((uintptr_t) slot->ptr, 16);
+    WriteStr(" of ");
+    WriteNum(slot->size, 10);
+    WriteStr(" bytes\n");
+    WriteStr("  allocated by:\n");
+    backtrace_symbols_fd(slot->allocTrace, slot->allocDepth, STDERR_FILENO);
+    if (slot->state == SLOT_FREED) {
+        WriteStr("  freed by:\n");
+        backtrace_symbols_fd(slot->freeTrace, slot->freeDepth, STDERR_FILENO);
+    }
+}
+
+static void SegvHandler(int sig, siginfo_t* info, void* context) {
+    (void) sig;
+    (void) context;
+    uint8_t* addr = (uint8_t*) info->si_addr;
+    if (GUARDED_OWNS(addr)) {
+        GuardedSlot* slot = SlotOf(addr);
+        if (slot) {
+            // data pages are only protected while their slot is not allocated
+            ReportSlot(slot->state == SLOT_FREED ? "use-after-free" : "wild access", addr, slot);
+        }
+        else {
+            // a guard page is hit by overflowing the slot before it or underflowing the slot after it
+            size_t page = (size_t) (addr - guardedPoolBegin) / pageSize;
+            GuardedSlot* prev = page > 0 ? &slots[page/2 - 1] : NULL;
+            GuardedSlot* next = page/2 < GUARDED_NUM_SLOTS ? &slots[page/2] : NULL;
+            if (prev && prev->state == SLOT_ALLOCATED)
+                ReportSlot("buffer overflow", addr, prev);
+            else if (next && next->state == SLOT_ALLOCATED)
+                ReportSlot("buffer underflow", addr, next);
+            else
+                ReportSlot("guard page access", addr, NULL);
+        }
+    }
+
+    // hand the fault to the previous handler, the access is retried on return
+    sigaction(SIGSEGV, &prevSegvAction, NULL);
+}
+
+static bool InitPool(void) {
+    if (guardedPoolBegin)
+        return true;
+    // don't retry if the pool couldn't be created
+    if (didInitPool)
+        return false;
+    didInitPool = true;
+
+    pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t poolSize = (2*GUARDED_NUM_SLOTS + 1) * pageSize;
+    void* pool = mmap(NULL, poolSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED)
+        return false;
+
+    // backtrace loads its unwinder on first use, don't do that in the middle of an allocation later
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = SegvHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &prevSegvAction);
+
+    guardedPoolBegin = (uint8_t*) pool;
+    guardedPoolEnd = guardedPoolBegin + poolSize;
+    return true;
+}
+
+void GuardedInit(void) {
+    const char* rate = getenv(GUARDED_RATE_ENV);
+    if (rate)
+        yguarded_set_sample_rate((uint32_t) strtoul(rate, NULL, 10));
+}
+
+void yguarded_set_sample_rate(uint32_t rate) {
+    sampleRate = rate;
+    guardedCountdown = NextCountdown();
+}
+
+void* GuardedAlloc(size_t size) {
+    guardedCountdown = NextCountdown();
+    if (!InitPool())
+        return NULL;
+
+    size_t alignedSize = HEAP_ALIGN_UP(size);
+    if (alignedSize > pageSize)
+        return NULL;
+
+    // reuse slots round robin, so freed pages stay protected for as long as possible
+    size_t idx = nextSlot;
+    for (size_t i = 0; slots[idx].state == SLOT_ALLOCATED; ++i) {
+        if (i == GUARDED_NUM_SLOTS)
+            return NULL;
+        idx = (idx + 1) % GUARDED_NUM_SLOTS;
+    }
+    nextSlot = (idx + 1) % GUARDED_NUM_SLOTS;
+
+    uint8_t* page = SlotPage(idx);
+    if (mprotect(page, pageSize, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+
+    GuardedSlot* slot = &slots[idx];
+    slot->state = SLOT_ALLOCATED;
+    slot->ptr = page + pageSize - alignedSize;
+    slot->size = size;
+    slot->allocDepth = backtrace(slot->allocTrace, GUARDED_MAX_FRAMES);
+    slot->freeDepth = 0;
+    return slot->ptr;
+}
+
+void GuardedFree(void* ptr) {
+    GuardedSlot* slot = SlotOf(ptr);
+    if (slot == NULL || slot->state != SLOT_ALLOCATED || slot->ptr != ptr) {
+        ReportSlot(slot && slot->state == SLOT_FREED ? "double free" : "invalid free", ptr, slot);
+        abort();
+    }
+
+    slot->state = SLOT_FREED;
+    slot->freeDepth = backtrace(slot->freeTrace, GUARDED_MAX_FRAMES);
+
+    // drop the contents so the page is zero when reused, then protect it
+    uint8_t* page = SlotPage((size_t) (slot - slots));
+    madvise(page, pageSize, MADV_DONTNEED);
+    mprotect(page, pageSize, PROT_NONE);
+}
+
+size_t GuardedSize(void* ptr) {
+    GuardedSlot* slot = SlotOf(ptr);
+    if (slot == NULL || slot->state != SLOT_ALLOCATED)
+        return 0;
+    return slot->size;
+}
@@ -0,0 +1,32 @@
+// internal header
+// don't include this file, include "ymalloc.h" instead
+
+#ifndef GUARDED_H
+#define GUARDED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// sampled allocations placed at the end of their own page, followed by a PROT_NONE guard page
+// freed pages are protected too, so overflows and use-after-frees fault and get reported
+
+#define GUARDED_NUM_SLOTS 64
+#define GUARDED_MAX_FRAMES 16
+#define GUARDED_RATE_ENV "YMALLOC_GUARDED_SAMPLE_RATE"
+
+// allocations until the next sample, 0 when sampling is disabled
+extern uint32_t guardedCountdown;
+extern uint8_t* guardedPoolBegin;
+extern uint8_t* guardedPoolEnd;
+
+// single branch when disabled, a decrement when enabled
+#define GUARDED_SHOULD_SAMPLE() (guardedCountdown != 0 && --guardedCountdown == 0)
+#define GUARDED_OWNS(p) ((uint8_t*) (p) >= guardedPoolBegin && (uint8_t*) (p) < guardedPoolEnd)
+
+void GuardedInit(void);
+// returns zeroed memory, or NULL if the size doesn't fit a page or every slot is in use
+void* GuardedAlloc(size_t size);
+void GuardedFree(void* ptr);
+size_t GuardedSize(void* ptr);
+
+#endif // GUARDED_H
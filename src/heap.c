@@ -1,13 +1,192 @@
 #include "heap.h"
+#include "ymalloc.h"
+#include "trace.h"
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
-static void* heapBase = NULL;
+uint8_t* yheapBase = NULL;
 static size_t heapSize = 0;
+size_t heapInitSize = HEAP_INIT_SIZE;
+size_t heapGrowMin = 0;
 
-void* HeapBegin(void) { return heapBase; }
-void* HeapEnd(void) { return ((uint8_t*) heapBase) + heapSize; }
+// new heap memory comes from sbrk, or from a caller supplied region
+// either way it must be contiguous with the end of the heap
+// returns the start of the new memory (the current end for size 0) or NULL
+typedef void* (*HeapSource)(size_t size);
+
+static void* SbrkMore(size_t size) {
+    void* ptr = sbrk(size);
+    return SBRK_OK(ptr) ? ptr : NULL;
+}
+
+static uint8_t* regionTop = NULL;
+static uint8_t* regionEnd = NULL;
+static yheap_grow_fn regionGrow = NULL;
+static void* regionGrowArg = NULL;
+
+// bump allocates from the region, only asking the grow callback (if any) once it is used up
+static void* RegionMore(size_t size) {
+    size_t available = (size_t) (regionEnd - regionTop);
+    if (size > available) {
+        if (!regionGrow)
+            return NULL;
+        size_t needed = size - available;
+        size_t added = regionGrow(regionEnd, needed, regionGrowArg);
+        if (added < needed)
+            return NULL;
+        regionEnd += added;
+    }
+    void* ptr = regionTop;
+    regionTop += size;
+    return ptr;
+}
+
+static HeapSource heapMore = SbrkMore;
+// whether memory from heapMore is known to be zero
+static bool heapMoreZeroed = true;
+
+// heap size limits in bytes, 0 for none
+static size_t softLimit = 0;
+static size_t hardLimit = 0;
+static bool softLimitCrossed = false;
+bool heapOverSoftLimit = false;
+
+typedef struct {
+    yheap_pressure_fn fn;
+    void* arg;
+} PressureCallback;
+
+static PressureCallback pressureCallbacks[HEAP_MAX_PRESSURE_CALLBACKS];
+static bool inPressureCallbacks = false;
+
+int HeapUseRegion(void* base, size_t len, bool zeroed) {
+    // too late once the heap exists
+    if (yheapBase)
+        return -1;
+
+    uint8_t* begin = (uint8_t*) HEAP_ALIGN_UP((uintptr_t) base);
+    uint8_t* end = (uint8_t*) ((((uintptr_t) base) + len) & ~(HEAP_ALIGNMENT-1));
+    if (end < begin || (size_t) (end - begin) < BLOCK_MIN_SIZE)
+        return -1;
+
+    regionTop = begin;
+    regionEnd = end;
+    heapMore = RegionMore;
+    heapMoreZeroed = zeroed;
+    return 0;
+}
+
+int HeapRestoreRegion(void* base, size_t heapLen, size_t len, bool zeroed) {
+    if (heapLen > len || HeapUseRegion(base, len, zeroed) != 0)
+        return -1;
+    yheapBase = regionTop;
+    heapSize = heapLen;
+    regionTop += heapLen;
+    return 0;
+}
+
+int yheap_init_region(void* base, size_t len) {
+    return HeapUseRegion(base, len, false);
+}
+
+void yheap_set_grow_callback(yheap_grow_fn fn, void* arg) {
+    regionGrow = fn;
+    regionGrowArg = arg;
+}
+
+bool HeapCanPurge(void) { return heapMore == SbrkMore; }
+
+// someone else may have moved the break since
+bool HeapCanShrink(void) { return heapMore == SbrkMore && sbrk(0) == HeapEnd(); }
+
+int HeapShrink(size_t size) {
+    if (size > heapSize || !HeapCanShrink())
+        return -1;
+    if (!SBRK_OK(sbrk(-(intptr_t) size)))
+        return -1;
+    heapSize -= size;
+    TRACE_EVENT(trim, YHEAP_EVENT_TRIM, HeapEnd(), size);
+    if (softLimit != 0 && heapSize <= softLimit) {
+        heapOverSoftLimit = false;
+        softLimitCrossed = false;
+    }
+    return 0;
+}
+
+int yheap_set_limits(size_t soft, size_t hard) {
+    if (hard != 0 && soft > hard)
+        return -1;
+    softLimit = soft;
+    hardLimit = hard;
+    softLimitCrossed = false;
+    heapOverSoftLimit = soft != 0 && heapSize > soft;
+    return 0;
+}
+
+bool HeapSoftLimitCrossed(size_t size) {
+    if (softLimit == 0)
+        return false;
+    if (heapSize + size <= softLimit) {
+        softLimitCrossed = false;
+        return false;
+    }
+    if (softLimitCrossed)
+        return false;
+    softLimitCrossed = true;
+    return true;
+}
+
+int yheap_add_pressure_callback(yheap_pressure_fn fn, void* arg) {
+    for (size_t i = 0; i < HEAP_MAX_PRESSURE_CALLBACKS; ++i) {
+        if (pressureCallbacks[i].fn == NULL) {
+            pressureCallbacks[i].fn = fn;
+            pressureCallbacks[i].arg = arg;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void yheap_remove_pressure_callback(yheap_pressure_fn fn, void* arg) {
+    for (size_t i = 0; i < HEAP_MAX_PRESSURE_CALLBACKS; ++i) {
+        if (pressureCallbacks[i].fn == fn && pressureCallbacks[i].arg == arg) {
+            pressureCallbacks[i].fn = NULL;
+            pressureCallbacks[i].arg = NULL;
+        }
+    }
+}
+
+// callbacks may allocate, which must not run them again
+void HeapRunPressureCallbacks(void) {
+    if (inPressureCallbacks)
+        return;
+    inPressureCallbacks = true;
+    for (size_t i = 0; i < HEAP_MAX_PRESSURE_CALLBACKS; ++i) {
+        if (pressureCallbacks[i].fn)
+            pressureCallbacks[i].fn(heapSize, softLimit, pressureCallbacks[i].arg);
+    }
+    inPressureCallbacks = false;
+}
+
+void* HeapBegin(void) { return yheapBase; }
+void* HeapEnd(void) { return ((uint8_t*) yheapBase) + heapSize; }
+
+int yheap_walk(yheap_walk_fn fn, void* arg) {
+    // follow the implicit list using the header sizes
+    uint8_t* end = HeapEnd();
+    for (uint8_t* curr = yheapBase;
+        curr != NULL && curr < end;
+        curr += BLOCKSIZE_BYTES(*(BlockSize*) curr) + BLOCK_AUXILIARY_SIZE)
+    {
+        BlockSize header = *(BlockSize*) curr;
+        int ret = fn(curr + BLOCK_HEADER_SIZE, BLOCKSIZE_BYTES(header), BLOCKSIZE_USAGE(header) == BLOCK_FREE, arg);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
 
 BlockNode* InitBlock(void* ptr, size_t size, BlockUsage usage) {
     BlockSize* header = (BlockSize*) (((uint8_t*) ptr));
@@ -27,34 +206,54 @@ BlockNode* InitBlock(void* ptr, size_t size, BlockUsage usage) {
 
 void* HeapInit(void) {
     // don't init again
-    if (heapBase)
-        return heapBase;
+    if (yheapBase)
+        return yheapBase;
 
     // get the current break
-    void* base = sbrk(0);
-    if (!SBRK_OK(base))
+    void* base = heapMore(0);
+    if (!base)
         return NULL;
 
-    if (!HeapGrow(HEAP_INIT_SIZE))
+    // a region is already paid for, so start with all of it
+    size_t initSize = heapInitSize;
+    if (heapMore == RegionMore)
+        initSize = (size_t) (regionEnd - regionTop) - BLOCK_AUXILIARY_SIZE;
+    // a small hard limit still gets a heap
+    if (hardLimit != 0 && initSize + BLOCK_AUXILIARY_SIZE > hardLimit && hardLimit >= BLOCK_MIN_SIZE)
+        initSize = (hardLimit - BLOCK_AUXILIARY_SIZE) & ~(HEAP_ALIGNMENT-1);
+
+    if (!HeapGrow(initSize))
         return NULL;
 
-    return heapBase = base;
+    return yheapBase = base;
 }
 
 // grows the heap and creates a free block
 BlockSize* HeapGrow(size_t size) {
+    if (size > PAYLOAD_MAX_SIZE)
+        return NULL;
     // try to grow the heap
     size_t payloadSize = PAYLOAD_ALIGN(size);
     size_t blockSize = payloadSize + BLOCK_AUXILIARY_SIZE;
-    void* blockPtr = sbrk(blockSize);
-    if (!SBRK_OK(blockPtr))
+    if (hardLimit != 0 && heapSize + blockSize > hardLimit)
+        return NULL;
+    void* blockPtr = heapMore(blockSize);
+    if (!blockPtr)
         return NULL;
     
     // heap grow success
     heapSize += blockSize;
+    if (persistHeapSize)
+        *persistHeapSize = heapSize;
+    TRACE_EVENT(grow, YHEAP_EVENT_GROW, blockPtr, blockSize);
+    if (softLimit != 0 && heapSize > softLimit)
+        heapOverSoftLimit = true;
 
     // create a free block in the new space
+    // fresh memory from the kernel is already zero, remember that for ycalloc
     BlockNode* node = InitBlock(blockPtr, payloadSize, BLOCK_FREE);
     memset(node, 0, sizeof(BlockNode));
+    if (heapMoreZeroed)
+        BLOCKSIZE_SET_ZEROED(*(BlockSize*) blockPtr);
     return blockPtr;
 }
@@ -5,16 +5,31 @@
 #define HEAP_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
-typedef size_t BlockSize; // lsb represent freed status
+typedef size_t BlockSize; // lsb represent freed status, next bits represent zeroed and sampled status
+typedef uintptr_t BlockLink; // offset of a node from the heap base, 0 for none
 typedef struct BlockNode BlockNode;
 struct BlockNode {
-    BlockNode* link[2];
+    BlockLink link[2];
     // serves as either a doubly linked list or a binary tree, depending on implementations
-    // in an rb tree, node color can be stored in a lsb (cast to int and mask)
+    // in an rb tree, node color can be stored in a lsb (nodes are aligned, so offsets are too)
     // a doubly linked list is not entirely useful
+    // links are offsets rather than pointers so the heap can be mapped back at another address
 };
 
+// start of the heap, exported so the link helpers below inline to an add
+extern uint8_t* yheapBase;
+
+static inline BlockNode* BlockLinkNode(BlockLink link) {
+    return link ? (BlockNode*) (yheapBase + link) : NULL;
+}
+
+static inline BlockLink BlockLinkOf(BlockNode* node) {
+    return node ? (BlockLink) (((uint8_t*) node) - yheapBase) : 0;
+}
+
 typedef enum {
     BLOCK_USED = 0,
     BLOCK_FREE = 1,
@@ -23,9 +38,20 @@ typedef enum {
 // set
 #define BLOCKSIZE_ALLOC(x)        ((x) &= ~1)
 #define BLOCKSIZE_FREE(x)         ((x) |= 1)
+#define BLOCKSIZE_SET_ZEROED(x)   ((x) |= 2)
+#define BLOCKSIZE_CLEAR_ZEROED(x) ((x) &= ~2)
+#define BLOCKSIZE_SET_SAMPLED(x)  ((x) |= 4)
 // get
 #define BLOCKSIZE_USAGE(x)        ((x) & 1)
-#define BLOCKSIZE_BYTES(x)        ((x) & ~1)
+#define BLOCKSIZE_ZEROED(x)       (((x) >> 1) & 1)
+#define BLOCKSIZE_SAMPLED(x)      (((x) >> 2) & 1)
+#define BLOCKSIZE_BYTES(x)        ((x) & ~7)
+
+// the zeroed bit is only meaningful in the header of a free block
+// it means every payload byte past the free block links (PAYLOAD_MIN_SIZE) is zero,
+// which is true for fresh heap memory from sbrk since the break is only lowered to a page boundary
+// the sampled bit is only meaningful in the header of a used block, it is set when the heap profiler tracks it
+// payload sizes are multiples of 8, so a 64 bit machine is assumed to have room for the three bits
 
 
 #ifdef DEBUG
@@ -34,6 +60,7 @@ typedef enum {
     #define HEAP_INIT_SIZE 65536
 #endif
 #define SBRK_OK(p) ((p) != (void*) -1)
+#define HEAP_MAX_PRESSURE_CALLBACKS 8
 
 #define BUGGY_MAX_(a, b) ((a) > (b) ? (a) : (b))
 #define HEAP_ALIGNMENT (sizeof(uintptr_t))
@@ -41,6 +68,8 @@ typedef enum {
 #define BLOCK_AUXILIARY_SIZE (BLOCK_HEADER_SIZE*2)
 #define PAYLOAD_MIN_SIZE (sizeof(BlockNode))
 #define BLOCK_MIN_SIZE (BLOCK_AUXILIARY_SIZE + PAYLOAD_MIN_SIZE)
+// larger requests fail instead of overflowing the block size
+#define PAYLOAD_MAX_SIZE (SIZE_MAX / 2)
 
 #define HEAP_ALIGN_UP(sz) (((sz) + (HEAP_ALIGNMENT-1)) & ~(HEAP_ALIGNMENT-1))
 #define PAYLOAD_ALIGN(sz) HEAP_ALIGN_UP(BUGGY_MAX_(sz, PAYLOAD_MIN_SIZE))
@@ -55,7 +84,44 @@ typedef enum {
 void* HeapBegin(void);
 void* HeapEnd(void);
 BlockNode* InitBlock(void* ptr, size_t size, BlockUsage use);
+// payload size of the first heap block, and the least the heap grows by at a time (0 for exactly what is needed)
+// both default to compiled in values, and can be tuned at startup
+extern size_t heapInitSize;
+extern size_t heapGrowMin;
 void* HeapInit(void);
 BlockSize* HeapGrow(size_t size);
+// makes the heap grow into [base, base+len) instead of the data segment, must be called before HeapInit
+int HeapUseRegion(void* base, size_t len, bool zeroed);
+// adopts a heap of heapLen bytes already at the start of the (aligned) region, such as one mapped back from a file
+int HeapRestoreRegion(void* base, size_t heapLen, size_t len, bool zeroed);
+// whether free pages can be given back with madvise and read as zero afterwards (only true for sbrk memory)
+bool HeapCanPurge(void);
+// whether the end of the heap can be given back, only for sbrk memory while the break is still at the heap end
+bool HeapCanShrink(void);
+// gives size bytes at the end of the heap back to the system, returns 0 on success
+int HeapShrink(size_t size);
+// true if growing the heap by size crosses the soft limit, only once until the heap is below it again
+bool HeapSoftLimitCrossed(size_t size);
+// kept up to date as the heap grows and shrinks, so frees can cheaply check whether to trim
+extern bool heapOverSoftLimit;
+void HeapRunPressureCallbacks(void);
+
+// free index traversal (implemented in ymalloc.c)
+// depth is the node depth in a tree, or the position in a list
+typedef void (*FreeIndexVisitor)(BlockNode* node, int depth, void* arg);
+int FreeIndexKind(void);
+void FreeIndexWalk(FreeIndexVisitor visit, void* arg);
+// visits at most budget free blocks of at least minSize bytes, carrying on from where the previous scan stopped
+// returns true once the scan got to the end of the index, the next one starts over
+bool FreeIndexScan(size_t minSize, int budget, FreeIndexVisitor visit, void* arg);
+// adopts a stored root, used instead of HeapInit for a restored heap
+void FreeIndexLoad(BlockLink root);
+
+// file backed heap (implemented in persist.c)
+bool PersistActive(void);
+// the heap size and free index root in the file header, NULL unless the heap is in a file
+// the heap pages reach the file as soon as they are written, so these are updated on every change too
+extern uint64_t* persistHeapSize;
+extern BlockLink* persistFreeRoot;
 
 #endif // HEAP_H
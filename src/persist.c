@@ -0,0 +1,161 @@
+#include "ymalloc.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the heap lives in a shared file mapping
+// | header (1 page) | heap ...                                 | unused file space |
+// free index links and the root are offsets from the heap base, so the file can be mapped anywhere
+// address space for growth is reserved up front, so the mapping can be extended in place
+// the mapping is shared, so every change reaches the file right away, the header is kept up to date with it
+// and yheap_sync only has to flush, a process that exits without syncing still leaves a consistent file
+
+#define PERSIST_MAGIC "YMHEAP1"
+#define PERSIST_DEFAULT_RESERVE (((size_t) 1) << 36)
+#define PERSIST_GROW_STEP (((size_t) 1) << 20)
+
+typedef struct {
+    char magic[8];
+    uint64_t heapSize; // 0 until the first allocation
+    uint64_t freeRoot;
+    uint64_t root;
+} PersistHeader;
+
+static int persistFd = -1;
+static uint8_t* mapBase = NULL;
+static size_t mapSize = 0;
+static size_t reserveSize = 0;
+static size_t pageSize = 0;
+
+uint64_t* persistHeapSize = NULL;
+BlockLink* persistFreeRoot = NULL;
+
+bool PersistActive(void) { return persistFd >= 0; }
+
+// extends the file and maps the new part right after the old one
+static size_t PersistGrow(void* end, size_t size, void* arg) {
+    (void) arg;
+    assert(end == mapBase + mapSize);
+    size_t added = (size + PERSIST_GROW_STEP - 1) / PERSIST_GROW_STEP * PERSIST_GROW_STEP;
+    if (added > reserveSize - mapSize)
+        return 0;
+    if (ftruncate(persistFd, (off_t) (mapSize + added)) != 0)
+        return 0;
+    if (mmap(end, added, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, persistFd, (off_t) mapSize) == MAP_FAILED)
+        return 0;
+    mapSize += added;
+    return added;
+}
+
+int yheap_open_file(const char* path, size_t maxSize) {
+    // too late once the heap exists
+    if (persistFd >= 0 || HeapBegin() != NULL)
+        return -1;
+
+    pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    if (maxSize == 0)
+        maxSize = PERSIST_DEFAULT_RESERVE;
+    reserveSize = (maxSize + pageSize - 1) / pageSize * pageSize;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // new files get a header page and the first heap region, which reads as zero
+    size_t fileSize = (size_t) st.st_size;
+    bool isNew = fileSize == 0;
+    if (isNew) {
+        fileSize = pageSize + PERSIST_GROW_STEP;
+        if (ftruncate(fd, (off_t) fileSize) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (fileSize % pageSize != 0 || fileSize < pageSize + BLOCK_MIN_SIZE || fileSize > reserveSize) {
+        close(fd);
+        return -1;
+    }
+
+    void* reserve = mmap(NULL, reserveSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserve == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (mmap(reserve, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(reserve, reserveSize);
+        close(fd);
+        return -1;
+    }
+
+    PersistHeader* header = (PersistHeader*) reserve;
+    if (isNew)
+        memcpy(header->magic, PERSIST_MAGIC, sizeof(header->magic));
+    if (memcmp(header->magic, PERSIST_MAGIC, sizeof(header->magic)) != 0) {
+        munmap(reserve, reserveSize);
+        close(fd);
+        return -1;
+    }
+
+    // only a new file is known to be zero, an existing one may hold data past its recorded heap size
+    // (left by a process that exited without syncing, before the header was kept up to date)
+    // a recorded heap that doesn't fit the file, or a free index root outside of it, means the file is damaged
+    uint8_t* heapStart = (uint8_t*) reserve + pageSize;
+    int ret;
+    if (header->heapSize == 0)
+        ret = HeapUseRegion(heapStart, fileSize - pageSize, isNew);
+    else if (header->heapSize % HEAP_ALIGNMENT != 0 || header->freeRoot >= header->heapSize)
+        ret = -1;
+    else
+        ret = HeapRestoreRegion(heapStart, header->heapSize, fileSize - pageSize, false);
+    if (ret != 0) {
+        munmap(reserve, reserveSize);
+        close(fd);
+        return -1;
+    }
+
+    mapBase = (uint8_t*) reserve;
+    mapSize = fileSize;
+    persistFd = fd;
+    if (header->heapSize != 0)
+        FreeIndexLoad(header->freeRoot);
+    persistHeapSize = &header->heapSize;
+    persistFreeRoot = &header->freeRoot;
+    yheap_set_grow_callback(PersistGrow, NULL);
+    return 0;
+}
+
+int yheap_sync(void) {
+    if (persistFd < 0)
+        return -1;
+    return msync(mapBase, mapSize, MS_SYNC);
+}
+
+void* yheap_root(void) {
+    if (persistFd < 0)
+        return NULL;
+    return yheap_pointer(((PersistHeader*) mapBase)->root);
+}
+
+void yheap_set_root(void* ptr) {
+    if (persistFd >= 0)
+        ((PersistHeader*) mapBase)->root = yheap_offset(ptr);
+}
+
+size_t yheap_offset(void* ptr) {
+    return ptr ? (size_t) (((uint8_t*) ptr) - yheapBase) : 0;
+}
+
+void* yheap_pointer(size_t offset) {
+    return offset ? yheapBase + offset : NULL;
+}
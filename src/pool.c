@@ -0,0 +1,166 @@
+#include "ymalloc.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+// objects are packed back to back in chunks from the heap, without headers or footers
+// | next chunk (8) | padding to align | object | object | ... | object |
+// freed objects form an intrusive LIFO list through their first word, so the most recently
+// freed (cache hot) object is reused first
+
+#define POOL_CHUNK_SIZE (16*1024)
+#define POOL_MIN_CHUNK_OBJECTS 8
+
+typedef struct PoolChunk PoolChunk;
+struct PoolChunk {
+    PoolChunk* next;
+};
+
+typedef struct PoolFree PoolFree;
+struct PoolFree {
+    PoolFree* next;
+};
+
+struct ypool {
+    size_t objSize; // stride between objects
+    size_t align;
+    size_t chunkObjects;
+    size_t chunkSize; // bytes asked from the heap for each chunk
+    PoolFree* freeList;
+    // part of the newest chunk that was never handed out
+    uint8_t* bump;
+    uint8_t* bumpEnd;
+    PoolChunk* chunks;
+    ypool_init_fn init;
+    void* initArg;
+    ypool_stats stats;
+};
+
+ypool* ypool_create(size_t objsize, size_t align) {
+    if (align == 0)
+        align = HEAP_ALIGNMENT;
+    // free objects hold a pointer
+    if (align < sizeof(PoolFree))
+        align = sizeof(PoolFree);
+    if (objsize == 0 || (align & (align - 1)) != 0)
+        return NULL;
+    if (objsize < sizeof(PoolFree))
+        objsize = sizeof(PoolFree);
+
+    // sizes that can't make a chunk of at least POOL_MIN_CHUNK_OBJECTS objects are rejected up front,
+    // so a chunk size never wraps around to something smaller than the objects bumped out of it
+    if (objsize > SIZE_MAX - (align - 1))
+        return NULL;
+    size_t objSize = (objsize + align - 1) & ~(align - 1);
+    size_t chunkObjects = POOL_CHUNK_SIZE / objSize;
+    if (chunkObjects < POOL_MIN_CHUNK_OBJECTS)
+        chunkObjects = POOL_MIN_CHUNK_OBJECTS;
+    size_t chunkSize;
+    if (__builtin_mul_overflow(chunkObjects, objSize, &chunkSize) ||
+        __builtin_add_overflow(chunkSize, sizeof(PoolChunk) + align - 1, &chunkSize) ||
+        chunkSize > PAYLOAD_MAX_SIZE)
+    {
+        return NULL;
+    }
+
+    ypool* pool = ymalloc(sizeof(ypool));
+    if (pool == NULL)
+        return NULL;
+    memset(pool, 0, sizeof(ypool));
+    pool->objSize = objSize;
+    pool->align = align;
+    pool->chunkObjects = chunkObjects;
+    pool->chunkSize = chunkSize;
+    pool->stats.objsize = pool->objSize;
+    return pool;
+}
+
+void ypool_set_init(ypool* pool, ypool_init_fn fn, void* arg) {
+    pool->init = fn;
+    pool->initArg = arg;
+}
+
+// gets a new chunk from the heap and makes it the bump region
+static bool PoolGrow(ypool* pool) {
+    PoolChunk* chunk = ymalloc(pool->chunkSize);
+    if (chunk == NULL)
+        return false;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+
+    uintptr_t first = ((uintptr_t) (chunk + 1) + pool->align - 1) & ~(pool->align - 1);
+    pool->bump = (uint8_t*) first;
+    pool->bumpEnd = pool->bump + pool->chunkObjects * pool->objSize;
+    pool->stats.chunks++;
+    return true;
+}
+
+void* ypool_alloc(ypool* pool) {
+    void* obj;
+    if (pool->freeList) {
+        obj = pool->freeList;
+        pool->freeList = pool->freeList->next;
+    }
+    else {
+        if (pool->bump == pool->bumpEnd && !PoolGrow(pool))
+            return NULL;
+        obj = pool->bump;
+        pool->bump += pool->objSize;
+    }
+
+    pool->stats.allocs++;
+    pool->stats.live++;
+    if (pool->stats.live > pool->stats.highWater)
+        pool->stats.highWater = pool->stats.live;
+
+    if (pool->init)
+        pool->init(obj, pool->initArg);
+    return obj;
+}
+
+void ypool_free(ypool* pool, void* obj) {
+    if (obj == NULL)
+        return;
+
+#ifdef DEBUG
+    bool inPool = false;
+    for (PoolChunk* chunk = pool->chunks;
+        chunk != NULL;
+        chunk = chunk->next)
+    {
+        uint8_t* first = (uint8_t*) (((uintptr_t) (chunk + 1) + pool->align - 1) & ~(pool->align - 1));
+        uint8_t* last = first + pool->chunkObjects * pool->objSize;
+        if ((uint8_t*) obj >= first && (uint8_t*) obj < last) {
+            assert(((uint8_t*) obj - first) % pool->objSize == 0);
+            inPool = true;
+            break;
+        }
+    }
+    assert(inPool);
+#endif
+
+    PoolFree* node = (PoolFree*) obj;
+    node->next = pool->freeList;
+    pool->freeList = node;
+    pool->stats.frees++;
+    pool->stats.live--;
+}
+
+void ypool_destroy(ypool* pool) {
+    if (pool == NULL)
+        return;
+    PoolChunk* chunk = pool->chunks;
+    while (chunk) {
+        PoolChunk* next = chunk->next;
+        yfree(chunk);
+        chunk = next;
+    }
+    yfree(pool);
+}
+
+void ypool_get_stats(const ypool* pool, ypool_stats* stats) {
+    *stats = pool->stats;
+}
@@ -0,0 +1,374 @@
+#include "profile.h"
+#include "ymalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+// both tables are open addressed with linear probing and live in their own mappings,
+// so the profiler never allocates from the heap it is profiling
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty entry
+    int depth;
+    int64_t inuseCount;
+    int64_t inuseBytes;
+    int64_t allocCount;
+    int64_t allocBytes;
+    void* frames[PROFILE_MAX_FRAMES];
+} ProfileStack;
+
+typedef struct {
+    void* ptr; // NULL marks an empty entry
+    size_t size;
+    uint32_t stack;
+} ProfileLive;
+
+#define PROFILE_NO_STACK UINT32_MAX
+
+int64_t profileBytesUntilSample = INT64_MAX;
+
+static size_t sampleRate = 0;
+static size_t dumpRate = PROFILE_DEFAULT_RATE; // rate of the samples in the tables
+static uint64_t rngState = 0x2545F4914F6CDD1D;
+static ProfileStack* stacks = NULL;
+static ProfileLive* live = NULL;
+static size_t numStacks = 0;
+static size_t numLive = 0;
+
+// a dump requested by signal while the tables are being changed is deferred until they are consistent
+static volatile sig_atomic_t tablesBusy = 0;
+static volatile sig_atomic_t dumpPending = 0;
+static char signalDumpPath[256];
+
+// exponentially distributed with mean sampleRate, so every byte is equally likely to be sampled
+static int64_t NextSampleInterval(void) {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    // uniform in (0, 1]
+    double u = (double) (((rngState * 0x2545F4914F6CDD1DULL) >> 11) + 1) / 9007199254740992.0;
+    return (int64_t) (-log(u) * (double) sampleRate) + 1;
+}
+
+static size_t HashPtr(void* ptr) {
+    uint64_t x = (uintptr_t) ptr;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+static uint64_t HashFrames(void** frames, int depth) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < depth; ++i) {
+        h ^= (uintptr_t) frames[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h | 1;
+}
+
+// finds or creates the entry for a stack, returns PROFILE_NO_STACK if the table is full
+static uint32_t FindStack(void** frames, int depth) {
+    uint64_t hash = HashFrames(frames, depth);
+    size_t idx = hash & (PROFILE_MAX_STACKS - 1);
+    for (;;) {
+        ProfileStack* entry = &stacks[idx];
+        if (entry->hash == 0)
+            break;
+        if (entry->hash == hash && entry->depth == depth &&
+            memcmp(entry->frames, frames, depth * sizeof(void*)) == 0)
+        {
+            return (uint32_t) idx;
+        }
+        idx = (idx + 1) & (PROFILE_MAX_STACKS - 1);
+    }
+
+    if (numStacks >= PROFILE_MAX_STACKS * 3 / 4)
+        return PROFILE_NO_STACK;
+    ++numStacks;
+    stacks[idx].hash = hash;
+    stacks[idx].depth = depth;
+    memcpy(stacks[idx].frames, frames, depth * sizeof(void*));
+    return (uint32_t) idx;
+}
+
+static size_t FindLive(void* ptr) {
+    size_t idx = HashPtr(ptr) & (PROFILE_MAX_LIVE - 1);
+    while (live[idx].ptr != NULL && live[idx].ptr != ptr)
+        idx = (idx + 1) & (PROFILE_MAX_LIVE - 1);
+    return idx;
+}
+
+// backward shift deletion, entries after the hole move into it unless that would put them before their home slot
+static void RemoveLive(size_t hole) {
+    size_t j = hole;
+    for (;;) {
+        j = (j + 1) & (PROFILE_MAX_LIVE - 1);
+        if (live[j].ptr == NULL)
+            break;
+        size_t home = HashPtr(live[j].ptr) & (PROFILE_MAX_LIVE - 1);
+        bool canMove = hole < j ? (home <= hole || home > j)
+                                : (home <= hole && home > j);
+        if (canMove) {
+            live[hole] = live[j];
+            hole = j;
+        }
+    }
+    live[hole].ptr = NULL;
+    --numLive;
+}
+
+static bool InitTables(void) {
+    if (live)
+        return true;
+    void* stackMap = mmap(NULL, PROFILE_MAX_STACKS * sizeof(ProfileStack),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stackMap == MAP_FAILED)
+        return false;
+    void* liveMap = mmap(NULL, PROFILE_MAX_LIVE * sizeof(ProfileLive),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (liveMap == MAP_FAILED) {
+        munmap(stackMap, PROFILE_MAX_STACKS * sizeof(ProfileStack));
+        return false;
+    }
+
+    // backtrace loads its unwinder on first use, don't do that in the middle of an allocation later
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    stacks = (ProfileStack*) stackMap;
+    live = (ProfileLive*) liveMap;
+    return true;
+}
+
+static void DumpWrite(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+// lines are formatted by hand instead of with snprintf, so a dump can run in a signal handler
+typedef struct {
+    char buf[1024];
+    size_t len;
+} DumpLine;
+
+static void LineStr(DumpLine* line, const char* str) {
+    size_t n = strlen(str);
+    if (n > sizeof(line->buf) - line->len)
+        n = sizeof(line->buf) - line->len;
+    memcpy(line->buf + line->len, str, n);
+    line->len += n;
+}
+
+static void LineNum(DumpLine* line, uint64_t x, unsigned base) {
+    char buf[24];
+    char* curr = buf + sizeof(buf) - 1;
+    *curr = '\0';
+    do {
+        *--curr = "0123456789abcdef"[x % base];
+        x /= base;
+    } while (x != 0);
+    if (base == 16) {
+        *--curr = 'x';
+        *--curr = '0';
+    }
+    LineStr(line, curr);
+}
+
+static void LineInt(DumpLine* line, int64_t x) {
+    if (x < 0) {
+        LineStr(line, "-");
+        LineNum(line, -(uint64_t) x, 10);
+    }
+    else {
+        LineNum(line, (uint64_t) x, 10);
+    }
+}
+
+// "inuseCount: inuseBytes [allocCount: allocBytes] @"
+static void LineCounts(DumpLine* line, int64_t inuseCount, int64_t inuseBytes, int64_t allocCount, int64_t allocBytes) {
+    LineInt(line, inuseCount);
+    LineStr(line, ": ");
+    LineInt(line, inuseBytes);
+    LineStr(line, " [");
+    LineInt(line, allocCount);
+    LineStr(line, ": ");
+    LineInt(line, allocBytes);
+    LineStr(line, "] @");
+}
+
+// legacy gperftools heap profile, which pprof reads and unsamples using the rate after heap_v2/
+// only uses async-signal-safe calls, so it can run in a signal handler
+static int DumpPath(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int64_t inuseCount = 0, inuseBytes = 0, allocCount = 0, allocBytes = 0;
+    for (size_t i = 0; stacks && i < PROFILE_MAX_STACKS; ++i) {
+        inuseCount += stacks[i].inuseCount;
+        inuseBytes += stacks[i].inuseBytes;
+        allocCount += stacks[i].allocCount;
+        allocBytes += stacks[i].allocBytes;
+    }
+
+    DumpLine line = { .len = 0 };
+    LineStr(&line, "heap profile: ");
+    LineCounts(&line, inuseCount, inuseBytes, allocCount, allocBytes);
+    LineStr(&line, " heap_v2/");
+    LineNum(&line, dumpRate, 10);
+    LineStr(&line, "\n");
+    DumpWrite(fd, line.buf, line.len);
+
+    for (size_t i = 0; stacks && i < PROFILE_MAX_STACKS; ++i) {
+        ProfileStack* entry = &stacks[i];
+        if (entry->hash == 0)
+            continue;
+        line.len = 0;
+        LineCounts(&line, entry->inuseCount, entry->inuseBytes, entry->allocCount, entry->allocBytes);
+        for (int f = 0; f < entry->depth; ++f) {
+            LineStr(&line, " ");
+            LineNum(&line, (uintptr_t) entry->frames[f], 16);
+        }
+        // the frames always fit, 32 of them take at most 19 bytes each
+        LineStr(&line, "\n");
+        DumpWrite(fd, line.buf, line.len);
+    }
+
+    // pprof needs the mappings to symbolize the addresses
+    const char* header = "\nMAPPED_LIBRARIES:\n";
+    DumpWrite(fd, header, strlen(header));
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        ssize_t n;
+        while ((n = read(maps, line.buf, sizeof(line.buf))) > 0)
+            DumpWrite(fd, line.buf, (size_t) n);
+        close(maps);
+    }
+
+    close(fd);
+    return 0;
+}
+
+static void DumpSignalHandler(int sig) {
+    (void) sig;
+    if (tablesBusy)
+        dumpPending = 1;
+    else
+        DumpPath(signalDumpPath);
+}
+
+static void DumpIfPending(void) {
+    if (dumpPending) {
+        dumpPending = 0;
+        DumpPath(signalDumpPath);
+    }
+}
+
+void ProfileInit(void) {
+    const char* rate = getenv(PROFILE_RATE_ENV);
+    if (rate)
+        yprofile_start(strtoull(rate, NULL, 10));
+
+    const char* signo = getenv(PROFILE_SIGNAL_ENV);
+    if (signo) {
+        const char* path = getenv(PROFILE_PATH_ENV);
+        yprofile_dump_on_signal(atoi(signo), path ? path : PROFILE_DEFAULT_PATH);
+    }
+}
+
+bool ProfileRecordAlloc(void* ptr, size_t size) {
+    if (sampleRate == 0) {
+        profileBytesUntilSample = INT64_MAX;
+        return false;
+    }
+    profileBytesUntilSample = NextSampleInterval();
+
+    // skip this frame, the allocator entry point stays at the top of the stack
+    void* frames[PROFILE_MAX_FRAMES + 1];
+    int depth = backtrace(frames, PROFILE_MAX_FRAMES + 1) - 1;
+
+    tablesBusy = 1;
+    bool recorded = false;
+    uint32_t stack = FindStack(frames + 1, depth);
+    if (stack != PROFILE_NO_STACK && numLive < PROFILE_MAX_LIVE / 2) {
+        size_t idx = FindLive(ptr);
+        live[idx].ptr = ptr;
+        live[idx].size = size;
+        live[idx].stack = stack;
+        ++numLive;
+
+        ProfileStack* entry = &stacks[stack];
+        entry->inuseCount += 1;
+        entry->inuseBytes += (int64_t) size;
+        entry->allocCount += 1;
+        entry->allocBytes += (int64_t) size;
+        recorded = true;
+    }
+    tablesBusy = 0;
+
+    DumpIfPending();
+    return recorded;
+}
+
+void ProfileRecordFree(void* ptr) {
+    // a block marked by a previous run of a heap in a file
+    if (live == NULL)
+        return;
+
+    tablesBusy = 1;
+    size_t idx = FindLive(ptr);
+    if (live[idx].ptr == ptr) {
+        ProfileStack* entry = &stacks[live[idx].stack];
+        entry->inuseCount -= 1;
+        entry->inuseBytes -= (int64_t) live[idx].size;
+        RemoveLive(idx);
+    }
+    tablesBusy = 0;
+
+    DumpIfPending();
+}
+
+int yprofile_start(size_t sampleBytes) {
+    if (!InitTables())
+        return -1;
+    sampleRate = sampleBytes ? sampleBytes : PROFILE_DEFAULT_RATE;
+    dumpRate = sampleRate;
+    profileBytesUntilSample = NextSampleInterval();
+    return 0;
+}
+
+void yprofile_stop(void) {
+    // sampled allocations that are still live stay in the table until they are freed
+    sampleRate = 0;
+    profileBytesUntilSample = INT64_MAX;
+}
+
+int yprofile_dump(const char* path) {
+    return DumpPath(path);
+}
+
+int yprofile_dump_on_signal(int signo, const char* path) {
+    size_t len = strlen(path);
+    if (len >= sizeof(signalDumpPath))
+        return -1;
+    memcpy(signalDumpPath, path, len + 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = DumpSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signo, &action, NULL);
+}
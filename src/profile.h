@@ -0,0 +1,34 @@
+// internal header
+// don't include this file, include "ymalloc.h" instead
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// allocations are sampled every ~PROFILE_DEFAULT_RATE bytes (exponentially distributed intervals),
+// sampled allocations are marked in their header and tracked with their stack in a side table
+
+#define PROFILE_DEFAULT_RATE (512*1024)
+#define PROFILE_MAX_FRAMES 32
+#define PROFILE_MAX_STACKS 4096   // power of two
+#define PROFILE_MAX_LIVE 65536    // power of two
+#define PROFILE_RATE_ENV "YMALLOC_PROFILE_SAMPLE"
+#define PROFILE_SIGNAL_ENV "YMALLOC_PROFILE_SIGNAL"
+#define PROFILE_PATH_ENV "YMALLOC_PROFILE_PATH"
+#define PROFILE_DEFAULT_PATH "ymalloc.heap"
+
+// bytes until the next sample, INT64_MAX when profiling is off
+extern int64_t profileBytesUntilSample;
+
+// a single decrement and branch on unsampled allocations
+#define PROFILE_SHOULD_SAMPLE(size) ((profileBytesUntilSample -= (int64_t) (size)) < 0)
+
+void ProfileInit(void);
+// returns whether the allocation was recorded (and must be reported to ProfileRecordFree)
+bool ProfileRecordAlloc(void* ptr, size_t size);
+void ProfileRecordFree(void* ptr);
+
+#endif // PROFILE_H
@@ -0,0 +1,127 @@
+#include "purge.h"
+#include "ymalloc.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// | header (8) | next (8), prev (8) | timestamp (8) | ... pages ... | footer (8) |
+// free blocks are purged from the first to the last whole page of their payload,
+// the partial pages at either end are cleared by hand so the whole block reads as zero
+// there is no background thread since the allocator has no locking, instead the decay is checked
+// on large frees and when the heap grows, at most PURGE_TICKS_PER_DECAY times per decay period
+// a tick looks at a bounded number of blocks, if that isn't all of them the next large free or growth carries on
+
+uint64_t purgeDecayMs = PURGE_DEFAULT_DECAY_MS;
+bool purgeTickDue = false;
+size_t purgeMinPayload = SIZE_MAX;
+
+static bool decaySet = false;
+static uint64_t nextTickMs = 0;
+static size_t pageSize = 0;
+
+typedef struct {
+    uint64_t now;
+    bool force;
+} PurgeContext;
+
+// coarse clock is read from the vdso without a syscall, milliseconds are plenty for decay
+static uint64_t NowMs(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static uint64_t* BlockStamp(BlockSize* block) {
+    return (uint64_t*) (((uint8_t*) block) + BLOCK_HEADER_SIZE + PAYLOAD_MIN_SIZE);
+}
+
+void PurgeInit(void) {
+    pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    purgeMinPayload = PURGE_MIN_PAGES * pageSize;
+    const char* decay = getenv(PURGE_DECAY_ENV);
+    if (decay && !decaySet)
+        purgeDecayMs = strtoull(decay, NULL, 10);
+    // a region or file heap belongs to the caller, its pages can't be dropped
+    if (!HeapCanPurge())
+        purgeDecayMs = 0;
+    nextTickMs = NowMs() + purgeDecayMs / PURGE_TICKS_PER_DECAY;
+}
+
+void PurgeStamp(BlockSize* block) {
+    uint64_t now = NowMs();
+    *BlockStamp(block) = now;
+    if (now >= nextTickMs)
+        purgeTickDue = true;
+}
+
+// releases the whole pages of a free block and marks it zeroed, leaving the free index links alone
+static void PurgeBlock(BlockSize* block) {
+    uint8_t* begin = ((uint8_t*) block) + BLOCK_HEADER_SIZE + PAYLOAD_MIN_SIZE;
+    uint8_t* end = ((uint8_t*) block) + BLOCK_HEADER_SIZE + BLOCKSIZE_BYTES(*block);
+    uint8_t* pagesBegin = (uint8_t*) ((((uintptr_t) begin) + pageSize - 1) & ~(pageSize - 1));
+    uint8_t* pagesEnd = (uint8_t*) (((uintptr_t) end) & ~(pageSize - 1));
+    if (pagesEnd <= pagesBegin)
+        return;
+    if (madvise(pagesBegin, (size_t) (pagesEnd - pagesBegin), MADV_DONTNEED) != 0)
+        return;
+    memset(begin, 0, (size_t) (pagesBegin - begin));
+    memset(pagesEnd, 0, (size_t) (end - pagesEnd));
+    BLOCKSIZE_SET_ZEROED(*block);
+}
+
+static void VisitFreeNode(BlockNode* node, int depth, void* arg) {
+    (void) depth;
+    PurgeContext* ctx = (PurgeContext*) arg;
+    BlockSize* block = (BlockSize*) (((uint8_t*) node) - BLOCK_HEADER_SIZE);
+    if (BLOCKSIZE_ZEROED(*block) || BLOCKSIZE_BYTES(*block) < purgeMinPayload)
+        return;
+    // a block freed while purging was off has no stamp, anything past now is treated as expired
+    uint64_t stamp = *BlockStamp(block);
+    if (!ctx->force && stamp <= ctx->now && ctx->now - stamp < purgeDecayMs)
+        return;
+    PurgeBlock(block);
+}
+
+void PurgeTick(bool force) {
+    if (!force && purgeDecayMs == 0)
+        return;
+    PurgeContext ctx = { .now = NowMs(), .force = force };
+    if (!force && ctx.now < nextTickMs)
+        return;
+    nextTickMs = ctx.now + purgeDecayMs / PURGE_TICKS_PER_DECAY;
+    purgeTickDue = false;
+    if (HeapBegin() == NULL || !HeapCanPurge())
+        return;
+    if (force) {
+        FreeIndexWalk(VisitFreeNode, &ctx);
+        return;
+    }
+    // the rest of the index is still due, the clock isn't checked again until the scan gets to the end
+    if (!FreeIndexScan(purgeMinPayload, PURGE_TICK_BUDGET, VisitFreeNode, &ctx)) {
+        nextTickMs = ctx.now;
+        purgeTickDue = true;
+    }
+}
+
+void yheap_set_decay(size_t decayMs) {
+    decaySet = true;
+    purgeDecayMs = HeapBegin() != NULL && !HeapCanPurge() ? 0 : decayMs;
+}
+
+void yheap_purge_tick(void) {
+    PurgeTick(false);
+}
+
+void yheap_purge(void) {
+    PurgeTick(true);
+}
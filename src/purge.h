@@ -0,0 +1,38 @@
+// internal header
+// don't include this file, include "ymalloc.h" instead
+
+#ifndef PURGE_H
+#define PURGE_H
+
+#include "heap.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// dirty free blocks spanning whole pages are timestamped when they enter the free index,
+// pages of blocks that stayed free for longer than the decay time are given back with madvise
+// and the block is marked zeroed, so the memory is neither resident nor cleared again by ycalloc
+
+#define PURGE_DEFAULT_DECAY_MS 10000
+#define PURGE_TICKS_PER_DECAY 10
+#define PURGE_MIN_PAGES 2
+#define PURGE_TICK_BUDGET 64 // free blocks looked at per tick, an unfinished tick carries on at the next one
+#define PURGE_DECAY_ENV "YMALLOC_DECAY_MS"
+
+// 0 when purging is off
+extern uint64_t purgeDecayMs;
+// PURGE_MIN_PAGES runtime pages, nothing is stamped until the allocator is set up
+extern size_t purgeMinPayload;
+// set when a timestamp was taken after the next tick was due
+extern bool purgeTickDue;
+
+// the timestamp goes right after the free block links
+#define PURGE_SHOULD_STAMP(block) \
+    (BLOCKSIZE_BYTES(*(block)) >= purgeMinPayload && purgeDecayMs != 0 && !BLOCKSIZE_ZEROED(*(block)))
+
+void PurgeInit(void);
+void PurgeStamp(BlockSize* block);
+// purges blocks idle for longer than the decay time (or every dirty block if forced)
+// unless forced, does nothing until the next tick is due, and looks at PURGE_TICK_BUDGET blocks at most
+void PurgeTick(bool force);
+
+#endif // PURGE_H
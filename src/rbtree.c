@@ -137,6 +137,32 @@ BlockNode* RB_Ceiling(BlockNode* root, size_t size) {
     return RB_CeilingImpl(root, key);
 }
 
+// in order over the keys from lo to hi, so the closest fits are looked at first
+// nodes of one key are ordered by address, so either subtree may hold more of a key at the edge of the range
+static void RB_LowestFitImpl(BlockNode* x, RB_Key lo, RB_Key hi, BlockNode* below, uintptr_t align,
+    BlockNode** best, int* budget)
+{
+    if (x == NULL || *budget <= 0) return;
+    RB_Key key = RB_NODE_KEY(x);
+    if (key >= lo)
+        RB_LowestFitImpl(RB_NODE_LEFT(x), lo, hi, below, align, best, budget);
+    if (key >= lo && key <= hi && *budget > 0) {
+        --*budget;
+        if (x < below && ((uintptr_t) x & (align - 1)) == 0 && (*best == NULL || x < *best))
+            *best = x;
+    }
+    if (key <= hi)
+        RB_LowestFitImpl(RB_NODE_RIGHT(x), lo, hi, below, align, best, budget);
+}
+
+BlockNode* RB_LowestFit(BlockNode* root, size_t size, BlockNode* below, uintptr_t align, int budget) {
+    BlockNode* best = NULL;
+    // exact fits, then blocks that can be split, sizes in between don't fit and are skipped
+    RB_LowestFitImpl(root, size >> 1, size >> 1, below, align, &best, &budget);
+    RB_LowestFitImpl(root, (size + BLOCK_MIN_SIZE) >> 1, INT64_MAX, below, align, &best, &budget);
+    return best;
+}
+
 static BlockNode* RB_DeleteMinImpl(BlockNode* h) {
     assert(h != NULL);
     if (RB_NODE_LEFT(h) == NULL)
@@ -297,6 +323,40 @@ static bool RB_IsBalanced(BlockNode* root) {
     return RB_IsBalancedImpl(root, black);
 }
 
+static void RB_WalkImpl(BlockNode* x, int depth, FreeIndexVisitor visit, void* arg) {
+    if (x == NULL) return;
+    RB_WalkImpl(RB_NODE_LEFT(x), depth + 1, visit, arg);
+    visit(x, depth, arg);
+    RB_WalkImpl(RB_NODE_RIGHT(x), depth + 1, visit, arg);
+}
+
+// visit every node in order along with its depth
+void RB_Walk(BlockNode* root, FreeIndexVisitor visit, void* arg) {
+    RB_WalkImpl(root, 0, visit, arg);
+}
+
+static void RB_WalkFromImpl(BlockNode* x, int depth, RB_Key key, BlockNode* after,
+    FreeIndexVisitor visit, void* arg, int* budget, BlockNode** last)
+{
+    if (x == NULL || *budget <= 0) return;
+    // unless x comes after the start, neither does its left subtree
+    RB_Key k = RB_NODE_KEY(x);
+    if (k > key || (k == key && (uintptr_t) x > (uintptr_t) after)) {
+        RB_WalkFromImpl(RB_NODE_LEFT(x), depth + 1, key, after, visit, arg, budget, last);
+        if (*budget <= 0) return;
+        visit(x, depth, arg);
+        --*budget;
+        *last = x;
+    }
+    RB_WalkFromImpl(RB_NODE_RIGHT(x), depth + 1, key, after, visit, arg, budget, last);
+}
+
+BlockNode* RB_WalkFrom(BlockNode* root, RB_Key key, BlockNode* after, int budget, FreeIndexVisitor visit, void* arg) {
+    BlockNode* last = NULL;
+    RB_WalkFromImpl(root, 0, key, after, visit, arg, &budget, &last);
+    return budget > 0 ? NULL : last;
+}
+
 void RB_AssertInvariants(BlockNode* root) {
     assert(RB_IsBST(root));
     assert(RB_Is23(root));
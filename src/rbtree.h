@@ -9,23 +9,30 @@ typedef enum {
     RB_RED = 1,
 } NodeColor;
 
-#define RB_NODE_LEFT(x) ((BlockNode*)(((uintptr_t)(x)->link[0]) & ~1))
-#define RB_NODE_SET_LEFT(x, l) ((x)->link[0] = (BlockNode*)(((uintptr_t)l) | RB_NODE_COLOR(x)))
-#define RB_NODE_RIGHT(x) ((x)->link[1])
-#define RB_NODE_SET_RIGHT(x, r) ((x)->link[1] = r)
-#define RB_NODE_COLOR(x) (((uintptr_t)(x)->link[0]) & 1)
-#define RB_NODE_SET_COLOR(x, col) (((x)->link[0]) = (BlockNode*)(((uintptr_t)(x)->link[0] & ~1) | col))
-#define RB_NODE_SET_COLOR_RED(x) (((x)->link[0]) = (BlockNode*)(((uintptr_t)(x)->link[0] | 1)))
-#define RB_NODE_SET_COLOR_BLACK(x) (((x)->link[0]) = (BlockNode*)(((uintptr_t)(x)->link[0] & ~1)))
-#define RB_NODE_FLIP_COLOR(x) (((x)->link[0]) = (BlockNode*)(((uintptr_t)(x)->link[0] ^ 1)))
+#define RB_NODE_LEFT(x) BlockLinkNode((x)->link[0] & ~(BlockLink)1)
+#define RB_NODE_SET_LEFT(x, l) ((x)->link[0] = BlockLinkOf(l) | RB_NODE_COLOR(x))
+#define RB_NODE_RIGHT(x) BlockLinkNode((x)->link[1])
+#define RB_NODE_SET_RIGHT(x, r) ((x)->link[1] = BlockLinkOf(r))
+#define RB_NODE_COLOR(x) ((x)->link[0] & 1)
+#define RB_NODE_SET_COLOR(x, col) ((x)->link[0] = ((x)->link[0] & ~(BlockLink)1) | (col))
+#define RB_NODE_SET_COLOR_RED(x) ((x)->link[0] |= 1)
+#define RB_NODE_SET_COLOR_BLACK(x) ((x)->link[0] &= ~(BlockLink)1)
+#define RB_NODE_FLIP_COLOR(x) ((x)->link[0] ^= 1)
 #define RB_NODE_KEY(x) (RB_Key)(BLOCKSIZE_BYTES(*(BlockSize*)(((uint8_t*)(x)) - BLOCK_HEADER_SIZE)) >> 1)
 
 typedef int64_t RB_Key;
 
 BlockNode* RB_Ceiling(BlockNode* root, size_t size);
+// the lowest addressed node below "below" that fits size (exactly, or with room to split) and is aligned to align,
+// out of the first budget nodes in key order from size
+BlockNode* RB_LowestFit(BlockNode* root, size_t size, BlockNode* below, uintptr_t align, int budget);
 void RB_Delete(BlockNode** root, BlockNode* toDelete);
 void RB_Put(BlockNode** root, BlockNode* toInsert);
 void RB_AssertInvariants(BlockNode* root);
+void RB_Walk(BlockNode* root, FreeIndexVisitor visit, void* arg);
+// visits the first budget nodes in order after (key, after), after may be NULL for every node of key,
+// returns the last node visited, or NULL if the walk got to the end first
+BlockNode* RB_WalkFrom(BlockNode* root, RB_Key key, BlockNode* after, int budget, FreeIndexVisitor visit, void* arg);
 
 
 #endif // RBTREE_H
@@ -0,0 +1,113 @@
+#include "ymalloc.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// binary heap snapshot, all fields are native endian
+// | header | block headers (8 * blockCount) | free index entries (16 * freeCount) |
+// block offsets are implied by the sizes in their headers, in address order from heapBase
+// each free index entry is the offset of a free block header from heapBase and its depth
+
+#define SNAPSHOT_MAGIC "YMSNAP1"
+
+typedef struct {
+    char magic[8];
+    uint64_t heapBase;
+    uint64_t heapSize;
+    uint64_t blockCount;
+    uint64_t freeCount;
+    uint32_t freeIndexKind; // 0 for a red black tree, 1 for a linked list
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t depth;
+    uint32_t reserved;
+} SnapshotFreeEntry;
+
+// buffered so a multi GB heap is written with few syscalls
+typedef struct {
+    int fd;
+    bool failed;
+    size_t len;
+    uint8_t buf[1 << 16];
+} SnapshotWriter;
+
+static SnapshotWriter writer;
+
+static void WriterFlush(SnapshotWriter* w) {
+    uint8_t* buf = w->buf;
+    while (w->len > 0 && !w->failed) {
+        ssize_t n = write(w->fd, buf, w->len);
+        if (n <= 0) {
+            w->failed = true;
+            break;
+        }
+        buf += n;
+        w->len -= (size_t) n;
+    }
+    w->len = 0;
+}
+
+static void WriterPut(SnapshotWriter* w, const void* data, size_t size) {
+    if (w->len + size > sizeof(w->buf))
+        WriterFlush(w);
+    memcpy(w->buf + w->len, data, size);
+    w->len += size;
+}
+
+static void VisitFreeNode(BlockNode* node, int depth, void* arg) {
+    SnapshotHeader* header = (SnapshotHeader*) arg;
+    SnapshotFreeEntry entry = {
+        .offset = (uint64_t) (((uint8_t*) node) - BLOCK_HEADER_SIZE - (uint8_t*) HeapBegin()),
+        .depth = (uint32_t) depth,
+        .reserved = 0,
+    };
+    WriterPut(&writer, &entry, sizeof(entry));
+    header->freeCount++;
+}
+
+int yheap_snapshot(const char* path) {
+    writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer.fd < 0)
+        return -1;
+    writer.failed = false;
+    writer.len = 0;
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.heapBase = (uint64_t) (uintptr_t) HeapBegin();
+    header.heapSize = (uint64_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin());
+    header.freeIndexKind = (uint32_t) FreeIndexKind();
+
+    // counts are patched in once known
+    WriterPut(&writer, &header, sizeof(header));
+    uint8_t* end = HeapEnd();
+    for (uint8_t* curr = HeapBegin();
+        curr != NULL && curr < end;
+        curr += BLOCKSIZE_BYTES(*(BlockSize*) curr) + BLOCK_AUXILIARY_SIZE)
+    {
+        WriterPut(&writer, curr, sizeof(BlockSize));
+        header.blockCount++;
+    }
+    if (HeapBegin() != NULL)
+        FreeIndexWalk(VisitFreeNode, &header);
+    WriterFlush(&writer);
+
+    bool ok = !writer.failed && pwrite(writer.fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header);
+    ok = close(writer.fd) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+int yheap_snapshot_fork(const char* path) {
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(yheap_snapshot(path) == 0 ? 0 : 1);
+    return pid;
+}
@@ -11,6 +11,7 @@
 
 
 #define SAVE_LOG         0
+#define SAVE_SNAPSHOT    0
 #define NUM_ITERATIONS   500000
 #define MAX_ALLOCATIONS  500
 #define MIN_ALLOC_SIZE   32
@@ -64,6 +65,10 @@ clock_t doRandomAllocations(const char* logfile) {
     uint8_t currentPattern = 0;
     clock_t t0 = clock();
     for (int i = 0; i < NUM_ITERATIONS; ++i) {
+#if SAVE_SNAPSHOT
+        if (i == NUM_ITERATIONS/2 && malloc_fp == ymalloc)
+            yheap_snapshot("ymalloc.snap");
+#endif
         int idx = indices[i];
         if (allocations[idx].isAllocated) {
 #ifdef DEBUG
@@ -0,0 +1,12 @@
+#include "trace.h"
+#include "ymalloc.h"
+
+#include <stddef.h>
+
+yheap_event_fn traceHook = NULL;
+void* traceHookArg = NULL;
+
+void yheap_set_event_hook(yheap_event_fn fn, void* arg) {
+    traceHook = fn;
+    traceHookArg = arg;
+}
@@ -0,0 +1,32 @@
+// internal header
+// don't include this file, include "ymalloc.h" instead
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "ymalloc.h"
+
+// every event is a USDT probe in the "ymalloc" provider (when sys/sdt.h is available) and a call to the
+// event hook (when one is set), probes are a nop until perf or bpftrace attaches and the hook is one branch
+// probe names match the event names, e.g. usdt:./bin/test:ymalloc:malloc
+
+#if defined(__has_include) && !defined(YMALLOC_NO_USDT)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define TRACE_PROBE(name, ptr, size) DTRACE_PROBE2(ymalloc, name, ptr, size)
+    #endif
+#endif
+#ifndef TRACE_PROBE
+    #define TRACE_PROBE(name, ptr, size)
+#endif
+
+extern yheap_event_fn traceHook;
+extern void* traceHookArg;
+
+#define TRACE_EVENT(name, event, ptr, size) do { \
+    TRACE_PROBE(name, ptr, size); \
+    if (__builtin_expect(traceHook != NULL, 0)) \
+        traceHook(event, ptr, size, traceHookArg); \
+} while (0)
+
+#endif // TRACE_H
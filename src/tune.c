@@ -0,0 +1,279 @@
+#include "tune.h"
+#include "ymalloc.h"
+#include "heap.h"
+#include "purge.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// the profile is a text file of "key values..." lines
+//   allocs <count>, frees <count>, peak_live <bytes>, grows <count> <bytes>
+//   size <payload size> <count>                      for sizes up to TUNE_MAX_CLASS
+//   large <log2 size> <count> <bytes>                for larger sizes
+//   lifetime <log2 ns> <count> <count of large allocations>
+// the config written by tune.rb uses the same format
+//   classes <size> <size> ..., heap_init_size <bytes>, heap_grow_min <bytes>, decay_ms <ms>
+
+typedef struct {
+    void* ptr; // NULL marks an empty entry
+    size_t size;
+    uint64_t time;
+} TuneLive;
+
+size_t tuneMaxClass = 0;
+uint32_t tuneClassOf[TUNE_MAX_CLASS / HEAP_ALIGNMENT + 1];
+
+static char profilePath[256];
+static TuneLive* live = NULL;
+static size_t numLive = 0;
+static uint64_t allocs = 0;
+static uint64_t frees = 0;
+static uint64_t liveBytes = 0;
+static uint64_t peakLive = 0;
+static uint64_t grows = 0;
+static uint64_t growBytes = 0;
+static uint64_t sizeCounts[TUNE_MAX_CLASS / HEAP_ALIGNMENT + 1];
+static uint64_t largeCounts[TUNE_BUCKETS];
+static uint64_t largeBytes[TUNE_BUCKETS];
+static uint64_t lifetimeCounts[TUNE_BUCKETS];
+static uint64_t largeLifetimeCounts[TUNE_BUCKETS];
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static size_t Log2(uint64_t x) {
+    return x ? (size_t) (63 - __builtin_clzll(x)) : 0;
+}
+
+static size_t HashPtr(void* ptr) {
+    uint64_t x = (uintptr_t) ptr;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+static size_t FindLive(void* ptr) {
+    size_t idx = HashPtr(ptr) & (TUNE_MAX_LIVE - 1);
+    while (live[idx].ptr != NULL && live[idx].ptr != ptr)
+        idx = (idx + 1) & (TUNE_MAX_LIVE - 1);
+    return idx;
+}
+
+// backward shift deletion, same as the heap profiler
+static void RemoveLive(size_t hole) {
+    size_t j = hole;
+    for (;;) {
+        j = (j + 1) & (TUNE_MAX_LIVE - 1);
+        if (live[j].ptr == NULL)
+            break;
+        size_t home = HashPtr(live[j].ptr) & (TUNE_MAX_LIVE - 1);
+        bool canMove = hole < j ? (home <= hole || home > j)
+                                : (home <= hole && home > j);
+        if (canMove) {
+            live[hole] = live[j];
+            hole = j;
+        }
+    }
+    live[hole].ptr = NULL;
+    --numLive;
+}
+
+static void RecordAlloc(void* ptr, size_t size) {
+    ++allocs;
+    size_t aligned = PAYLOAD_ALIGN(size);
+    if (aligned <= TUNE_MAX_CLASS) {
+        sizeCounts[aligned / HEAP_ALIGNMENT]++;
+    }
+    else {
+        largeCounts[Log2(size)]++;
+        largeBytes[Log2(size)] += size;
+    }
+    liveBytes += size;
+    if (liveBytes > peakLive)
+        peakLive = liveBytes;
+
+    // allocations past the table capacity are counted, but their lifetime is not known
+    if (numLive < TUNE_MAX_LIVE / 2) {
+        size_t idx = FindLive(ptr);
+        if (live[idx].ptr == NULL)
+            ++numLive;
+        live[idx].ptr = ptr;
+        live[idx].size = size;
+        live[idx].time = NowNs();
+    }
+}
+
+static void RecordFree(void* ptr, size_t size) {
+    ++frees;
+    liveBytes -= liveBytes < size ? liveBytes : size;
+    size_t idx = FindLive(ptr);
+    if (live[idx].ptr == ptr) {
+        size_t bucket = Log2(NowNs() - live[idx].time);
+        lifetimeCounts[bucket]++;
+        if (live[idx].size >= TUNE_LARGE_SIZE)
+            largeLifetimeCounts[bucket]++;
+        RemoveLive(idx);
+    }
+}
+
+static void RecordResize(void* ptr, size_t size) {
+    size_t idx = FindLive(ptr);
+    if (live[idx].ptr != ptr)
+        return;
+    liveBytes += size - live[idx].size;
+    if (liveBytes > peakLive)
+        peakLive = liveBytes;
+    live[idx].size = size;
+}
+
+static void TuneEvent(yheap_event event, void* ptr, size_t size, void* arg) {
+    (void) arg;
+    switch (event) {
+    case YHEAP_EVENT_MALLOC:
+        RecordAlloc(ptr, size);
+        break;
+    case YHEAP_EVENT_FREE:
+        RecordFree(ptr, size);
+        break;
+    case YHEAP_EVENT_REALLOC_INPLACE:
+        RecordResize(ptr, size);
+        break;
+    case YHEAP_EVENT_GROW:
+        ++grows;
+        growBytes += size;
+        break;
+    default:
+        break;
+    }
+}
+
+static void DumpWrite(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+int ytune_dump(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+        "# ymalloc tuning profile, read by tune.rb\nallocs %lu\nfrees %lu\npeak_live %lu\ngrows %lu %lu\n",
+        allocs, frees, peakLive, grows, growBytes);
+    DumpWrite(fd, line, (size_t) len);
+    for (size_t i = 0; i <= TUNE_MAX_CLASS / HEAP_ALIGNMENT; ++i) {
+        if (sizeCounts[i] == 0)
+            continue;
+        len = snprintf(line, sizeof(line), "size %zu %lu\n", i * HEAP_ALIGNMENT, sizeCounts[i]);
+        DumpWrite(fd, line, (size_t) len);
+    }
+    for (size_t i = 0; i < TUNE_BUCKETS; ++i) {
+        if (largeCounts[i] == 0)
+            continue;
+        len = snprintf(line, sizeof(line), "large %zu %lu %lu\n", i, largeCounts[i], largeBytes[i]);
+        DumpWrite(fd, line, (size_t) len);
+    }
+    for (size_t i = 0; i < TUNE_BUCKETS; ++i) {
+        if (lifetimeCounts[i] == 0)
+            continue;
+        len = snprintf(line, sizeof(line), "lifetime %zu %lu %lu\n", i, lifetimeCounts[i], largeLifetimeCounts[i]);
+        DumpWrite(fd, line, (size_t) len);
+    }
+    return close(fd);
+}
+
+static void DumpAtExit(void) {
+    ytune_dump(profilePath);
+}
+
+int ytune_start(const char* path) {
+    size_t len = strlen(path);
+    if (len >= sizeof(profilePath))
+        return -1;
+    if (live == NULL) {
+        void* map = mmap(NULL, TUNE_MAX_LIVE * sizeof(TuneLive),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED)
+            return -1;
+        live = (TuneLive*) map;
+        atexit(DumpAtExit);
+    }
+    memcpy(profilePath, path, len + 1);
+    // record the sizes that were asked for, not the classes of a previous tuning
+    tuneMaxClass = 0;
+    yheap_set_event_hook(TuneEvent, NULL);
+    return 0;
+}
+
+// classes must be increasing multiples of the alignment, anything else is skipped
+static void LoadClasses(char* values) {
+    size_t prev = 0;
+    char* end;
+    for (unsigned long long c = strtoull(values, &end, 10);
+        end != values;
+        c = strtoull(values, &end, 10))
+    {
+        values = end;
+        size_t size = (size_t) c;
+        if (size < PAYLOAD_MIN_SIZE || size > TUNE_MAX_CLASS || size % HEAP_ALIGNMENT != 0 || size <= prev)
+            continue;
+        for (size_t s = prev + HEAP_ALIGNMENT; s <= size; s += HEAP_ALIGNMENT)
+            tuneClassOf[s / HEAP_ALIGNMENT] = (uint32_t) size;
+        prev = size;
+    }
+    tuneMaxClass = prev;
+}
+
+int ytune_load(const char* path) {
+    // read without stdio, which may allocate
+    static char buf[16384];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(buf) - 1 && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+        len += (size_t) n;
+    close(fd);
+    buf[len] = '\0';
+
+    for (char* line = strtok(buf, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        char* values = strchr(line, ' ');
+        if (line[0] == '#' || values == NULL)
+            continue;
+        *values++ = '\0';
+        if (strcmp(line, "classes") == 0)
+            LoadClasses(values);
+        else if (strcmp(line, "heap_init_size") == 0)
+            heapInitSize = HEAP_ALIGN_UP((size_t) strtoull(values, NULL, 10));
+        else if (strcmp(line, "heap_grow_min") == 0)
+            heapGrowMin = HEAP_ALIGN_UP((size_t) strtoull(values, NULL, 10));
+        else if (strcmp(line, "decay_ms") == 0)
+            purgeDecayMs = strtoull(values, NULL, 10);
+    }
+    return 0;
+}
+
+void TuneInit(void) {
+    const char* profile = getenv(TUNE_PROFILE_ENV);
+    const char* config = getenv(TUNE_CONFIG_ENV);
+    if (config)
+        ytune_load(config);
+    if (profile)
+        ytune_start(profile);
+}
@@ -0,0 +1,31 @@
+// internal header
+// don't include this file, include "ymalloc.h" instead
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "heap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// a tuning profile records the size and lifetime of every allocation through the event hook,
+// tune.rb fits size classes and heap thresholds to it, and the allocator loads them back at startup
+// sizes up to the largest class are rounded up to a class with a single table lookup
+
+#define TUNE_MAX_CLASS 65536
+#define TUNE_MAX_LIVE (1 << 20)    // power of two
+#define TUNE_BUCKETS 64            // power of two buckets for large sizes and lifetimes
+#define TUNE_LARGE_SIZE (8*1024)   // lifetimes of allocations at least this large are also counted apart
+#define TUNE_PROFILE_ENV "YMALLOC_TUNE_PROFILE"
+#define TUNE_CONFIG_ENV "YMALLOC_CONFIG"
+
+// 0 when no classes are loaded
+extern size_t tuneMaxClass;
+extern uint32_t tuneClassOf[TUNE_MAX_CLASS / HEAP_ALIGNMENT + 1];
+
+// size must be payload aligned
+#define TUNE_SIZE_CLASS(size) ((size) <= tuneMaxClass ? (size_t) tuneClassOf[(size) / HEAP_ALIGNMENT] : (size))
+
+void TuneInit(void);
+
+#endif // TUNE_H
@@ -1,5 +1,10 @@
 #include "ymalloc.h"
 #include "heap.h"
+#include "guarded.h"
+#include "profile.h"
+#include "purge.h"
+#include "trace.h"
+#include "tune.h"
 
 #include <stddef.h>
 #include <stdlib.h>
@@ -23,116 +28,73 @@
 static bool didInitHeap = false;
 #define LL_IMPL 0
 
+// relocation hints look at the blocks within RELOCATE_WINDOW bytes on either side (at most RELOCATE_BLOCKS_MAX
+// each way), an object is worth moving if less than RELOCATE_SPARSE_PERCENT of that is in use
+// and one of the first RELOCATE_SCAN_MAX fits in the free index (closest first) is at a lower address
+#define RELOCATE_WINDOW (32 * 1024)
+#define RELOCATE_BLOCKS_MAX 256
+#define RELOCATE_SPARSE_PERCENT 50
+#define RELOCATE_SCAN_MAX 64
+
 
 #if LL_IMPL
 
-#define LL_FIRST_FIT 0
+#include "freelist.h"
 
 static BlockNode* freeHead = NULL;
 
-// inserts a free block to the free list/tree
-static void InsertFreeBlock(BlockSize* block) {
-    assert(block != NULL);
-    assert(BLOCKSIZE_USAGE(*block) == BLOCK_FREE);
+int FreeIndexKind(void) { return 1; }
 
-    // set the block pointers (insert at front of the free list)
-    BlockNode* node = (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE);
+void FreeIndexWalk(FreeIndexVisitor visit, void* arg) {
+    FL_Walk(freeHead, visit, arg);
+}
 
-#ifdef DEBUG
-    for (BlockNode* curr = freeHead;
-        curr != NULL;
-        curr = curr->link[1])
-    {
-        assert(curr != node);
-    }
-#endif
+// the list has no order to resume from, so the position is kept, blocks freed since then shift it a little
+static size_t scanPos = 0;
 
-    if (freeHead) {
-        node->link[1] = freeHead;
-        if (node->link[1]) {
-            dbgf("node->next = %p\n", (void*) node->link[1]);
-            dbgf("node->next->prev = %p\n", (void*) node->link[1]->link[0]);
-            assert(node->link[1]->link[0] == NULL);
-            node->link[1]->link[0] = node;
-        }
-    }
-    else {
-        node->link[1] = NULL;
-    }
-    node->link[0] = NULL;
-    freeHead = node;
+bool FreeIndexScan(size_t minSize, int budget, FreeIndexVisitor visit, void* arg) {
+    scanPos = FL_WalkFrom(freeHead, scanPos, minSize, budget, visit, arg);
+    return scanPos == 0;
 }
 
 // removes a free block from the free list/tree
 static void RemoveFreeBlock(BlockSize* block) {
     assert(block != NULL);
     assert(BLOCKSIZE_USAGE(*block) == BLOCK_FREE);
+    FL_Delete(&freeHead, (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE));
+    if (persistFreeRoot)
+        *persistFreeRoot = BlockLinkOf(freeHead);
+}
 
-    BlockNode* node = (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE);
-
-#ifdef DEBUG
-    bool hasNode = false;
-    for (BlockNode* curr = freeHead;
-        curr != NULL;
-        curr = curr->link[1])
-    {
-        if (curr == node) {
-            hasNode = true;
-            break;
-        }
-    }
-    assert(hasNode);
-#endif
-
-    BlockNode* prev = node->link[0];
-    BlockNode* next = node->link[1];
-    if (prev)
-        prev->link[1] = next;
-    else {
-        if (next)
-            freeHead = next;
-        else
-            freeHead = NULL;
-    }
-    if (next)
-        next->link[0] = prev;
+// inserts a free block to the free list/tree
+static void InsertFreeBlock(BlockSize* block) {
+    assert(block != NULL);
+    assert(BLOCKSIZE_USAGE(*block) == BLOCK_FREE);
+    if (PURGE_SHOULD_STAMP(block))
+        PurgeStamp(block);
+    FL_Put(&freeHead, (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE));
+    if (persistFreeRoot)
+        *persistFreeRoot = BlockLinkOf(freeHead);
 }
 
 // returns the smallest free block larger than size, such that either
 // 1. the block has the exact correct size (no split)
 // 2. the block is larger than size + BLOCK_MIN_SIZE (split)
 static BlockSize* BestFreeBlock(size_t size) {
-    if (!freeHead)
+    BlockNode* bestNode = FL_BestFit(freeHead, size);
+    if (bestNode == NULL)
         return NULL;
+    return (BlockSize*) (((uint8_t*) bestNode) - BLOCK_HEADER_SIZE);
+}
 
-    size_t sizeNeeded = size + BLOCK_MIN_SIZE;
-    BlockSize* bestBlock = NULL;
-    size_t leastWaste = SIZE_MAX;
-    for (BlockNode* curr = freeHead;
-        curr != NULL;
-        curr = curr->link[1])
-    {
-        BlockSize* header = (BlockSize*) (((uint8_t*) curr) - BLOCK_HEADER_SIZE);
-        size_t blockSize = BLOCKSIZE_BYTES(*header);
-
-        // exact fit
-        if (blockSize == size) {
-            return header;
-        }
-
-        // save the best fit that would split a block
-        if (blockSize >= sizeNeeded) {
-#if LL_FIRST_FIT
-            return header;
-#else
-            if (leastWaste > blockSize - sizeNeeded) {
-                leastWaste = blockSize - sizeNeeded;
-                bestBlock = header;
-            }
-#endif
-        }
-    }
-    return bestBlock;
+// the lowest addressed free block before "below" that fits size with a payload aligned to align,
+// out of the first few the index finds
+static BlockSize* LowestFreeBlock(size_t size, BlockSize* below, uintptr_t align) {
+    BlockNode* node = FL_LowestFit(freeHead, size,
+        (BlockNode*) (((uint8_t*) below) + BLOCK_HEADER_SIZE), align, RELOCATE_SCAN_MAX);
+    if (node == NULL)
+        return NULL;
+    return (BlockSize*) (((uint8_t*) node) - BLOCK_HEADER_SIZE);
 }
 
 #else
@@ -141,8 +103,36 @@ static BlockSize* BestFreeBlock(size_t size) {
 
 static BlockNode* freeRoot = NULL;
 
+int FreeIndexKind(void) { return 0; }
+
+void FreeIndexWalk(FreeIndexVisitor visit, void* arg) {
+    RB_Walk(freeRoot, visit, arg);
+}
+
+// where the previous scan stopped, kept by value since the node may have been allocated since
+static RB_Key scanKey = 0;
+static BlockNode* scanAfter = NULL;
+
+bool FreeIndexScan(size_t minSize, int budget, FreeIndexVisitor visit, void* arg) {
+    if (scanKey < (RB_Key) (minSize >> 1)) {
+        scanKey = (RB_Key) (minSize >> 1);
+        scanAfter = NULL;
+    }
+    BlockNode* last = RB_WalkFrom(freeRoot, scanKey, scanAfter, budget, visit, arg);
+    if (last == NULL) {
+        scanKey = 0;
+        scanAfter = NULL;
+        return true;
+    }
+    scanKey = RB_NODE_KEY(last);
+    scanAfter = last;
+    return false;
+}
+
 static void RemoveFreeBlock(BlockSize* block) {
     RB_Delete(&freeRoot, (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE));
+    if (persistFreeRoot)
+        *persistFreeRoot = BlockLinkOf(freeRoot);
 #ifdef DEBUG
     RB_AssertInvariants(freeRoot);
 #endif
@@ -151,10 +141,14 @@ static void RemoveFreeBlock(BlockSize* block) {
 static void InsertFreeBlock(BlockSize* block) {
     assert(block != NULL);
     assert(BLOCKSIZE_USAGE(*block) == BLOCK_FREE);
+    if (PURGE_SHOULD_STAMP(block))
+        PurgeStamp(block);
     BlockNode* node = (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE);
     RB_NODE_SET_LEFT(node, NULL);
     RB_NODE_SET_RIGHT(node, NULL);
     RB_Put(&freeRoot, node);
+    if (persistFreeRoot)
+        *persistFreeRoot = BlockLinkOf(freeRoot);
 #ifdef DEBUG
     RB_AssertInvariants(freeRoot);
 #endif
@@ -173,6 +167,16 @@ static BlockSize* BestFreeBlock(size_t size) {
     return best;
 }
 
+static BlockSize* LowestFreeBlock(size_t size, BlockSize* below, uintptr_t align) {
+    if (freeRoot == NULL)
+        return NULL;
+    BlockNode* node = RB_LowestFit(freeRoot, size,
+        (BlockNode*) (((uint8_t*) below) + BLOCK_HEADER_SIZE), align, RELOCATE_SCAN_MAX);
+    if (node == NULL)
+        return NULL;
+    return (BlockSize*) (((uint8_t*) node) - BLOCK_HEADER_SIZE);
+}
+
 
 #endif
 
@@ -180,6 +184,7 @@ static BlockSize* BestFreeBlock(size_t size) {
 
 // splits a free block and repairs the remaining block links
 // returns the newly shrunk free block
+// a used block (from realloc) leaves the rest used and out of the free index, for the caller to free
 // NOTE: assumes block is big enough to accomodate the smallest new block
 // NOTE: does not initialize the newly split block header/footer
 static BlockSize* SplitBlock(BlockSize* block, size_t size) {
@@ -195,14 +200,23 @@ static BlockSize* SplitBlock(BlockSize* block, size_t size) {
 
     BlockNode* oldNode = (BlockNode*) (((uint8_t*) block) + BLOCK_HEADER_SIZE);
     size_t oldSize = BLOCKSIZE_BYTES(*block);
+    bool zeroed = BLOCKSIZE_ZEROED(*block);
     assert(size + BLOCK_MIN_SIZE <= oldSize);
     // assert(size + BLOCK_MIN_SIZE <= oldSize + BLOCK_AUXILIARY_SIZE); // realloc
     size_t newSize = oldSize - size - BLOCK_AUXILIARY_SIZE;
 
     // initialize free block
     BlockSize* shrunk = (BlockSize*) (((uint8_t*) block) + BLOCK_AUXILIARY_SIZE + size);
-    InitBlock(shrunk, newSize, BLOCK_FREE);
+    InitBlock(shrunk, newSize, BLOCKSIZE_USAGE(*block));
     assert(oldNode == InitBlock(block, size, BLOCKSIZE_USAGE(*block)));
+    TRACE_EVENT(split, YHEAP_EVENT_SPLIT, ((uint8_t*) shrunk) + BLOCK_HEADER_SIZE, newSize);
+
+    // both halves keep the zeroed status, the new header and footer are not payload
+    // and the shrunk block links land where the old payload was zero or its links were
+    if (zeroed) {
+        BLOCKSIZE_SET_ZEROED(*block);
+        BLOCKSIZE_SET_ZEROED(*shrunk);
+    }
 
     if (BLOCKSIZE_USAGE(*block) == BLOCK_FREE) {
         InsertFreeBlock(shrunk);
@@ -247,6 +261,12 @@ static BlockSize* CoalesceBlocks(BlockSize* block) {
         RemoveFreeBlock(block);
     }
 
+    // the merged block is only zeroed if every part was, in which case the
+    // header, footer and links between the parts ("seams") must be cleared
+    bool zeroed = BLOCKSIZE_ZEROED(*block);
+    uint8_t* aboveSeam = NULL;
+    uint8_t* belowSeam = NULL;
+
     BlockSize* aboveFooter = (BlockSize*) (((uint8_t*) block) - BLOCK_HEADER_SIZE);
     BlockSize* belowHeader = (BlockSize*) (((uint8_t*) block) + BLOCK_AUXILIARY_SIZE + blockSize);
 
@@ -262,6 +282,8 @@ static BlockSize* CoalesceBlocks(BlockSize* block) {
         dbgf("MERGING ABOVE %p WITH %p\n", (void*) (((uint8_t*) aboveNode) - BLOCK_HEADER_SIZE), (void*) block);
         block = (BlockSize*) (((uint8_t*) aboveNode) - BLOCK_HEADER_SIZE);
         blockSize += aboveSize + BLOCK_AUXILIARY_SIZE;
+        zeroed = zeroed && BLOCKSIZE_ZEROED(*block);
+        aboveSeam = (uint8_t*) aboveFooter;
 
         // remove aboveNode from list
         RemoveFreeBlock(block);
@@ -274,90 +296,399 @@ static BlockSize* CoalesceBlocks(BlockSize* block) {
 
         // join blocks
         blockSize += belowSize + BLOCK_AUXILIARY_SIZE;
+        zeroed = zeroed && BLOCKSIZE_ZEROED(*belowHeader);
+        belowSeam = ((uint8_t*) belowHeader) - BLOCK_HEADER_SIZE;
 
         RemoveFreeBlock(belowHeader);
     }
 
     InitBlock(block, blockSize, BLOCK_FREE);
+    if (aboveSeam || belowSeam)
+        TRACE_EVENT(coalesce, YHEAP_EVENT_COALESCE, ((uint8_t*) block) + BLOCK_HEADER_SIZE, blockSize);
+    if (zeroed) {
+        // | footer (8) | header (8) | next (8), prev (8) |
+        if (aboveSeam)
+            memset(aboveSeam, 0, BLOCK_AUXILIARY_SIZE + PAYLOAD_MIN_SIZE);
+        if (belowSeam)
+            memset(belowSeam, 0, BLOCK_AUXILIARY_SIZE + PAYLOAD_MIN_SIZE);
+        BLOCKSIZE_SET_ZEROED(*block);
+    }
     return block;
 }
 
 
-void* ymalloc(size_t size) {
-    // nothing to allocate
-    if (size == 0)
-        return NULL;
-    size = PAYLOAD_ALIGN(size);
+// one time setup, on the first allocation or when a heap is loaded from a file
+static void InitAllocator(void) {
+    static bool didInitAllocator = false;
+    if (didInitAllocator)
+        return;
+    didInitAllocator = true;
+    // thresholds must be known before the heap is created
+    TuneInit();
+    // guarded pages live outside the heap, so they would be lost with a heap in a file
+    if (!PersistActive())
+        GuardedInit();
+    ProfileInit();
+    PurgeInit();
+}
 
+void FreeIndexLoad(BlockLink root) {
+#if LL_IMPL
+    freeHead = BlockLinkNode(root);
+#else
+    freeRoot = BlockLinkNode(root);
+#endif
+    InitAllocator();
+    didInitHeap = true;
+}
+
+// gives the page aligned end of a free block at the end of the heap back to the system
+static void TrimHeap(void) {
+    // a region heap or a moved break can't shrink, so don't churn the index for nothing
+    if (HeapBegin() == NULL || !HeapCanShrink())
+        return;
+    BlockSize* lastFooter = (BlockSize*) (((uint8_t*) HeapEnd()) - BLOCK_HEADER_SIZE);
+    if (BLOCKSIZE_USAGE(*lastFooter) != BLOCK_FREE)
+        return;
+    size_t size = BLOCKSIZE_BYTES(*lastFooter);
+    BlockSize* block = (BlockSize*) (((uint8_t*) lastFooter) - size - BLOCK_HEADER_SIZE);
+
+    // the rest of the heap gets whole pages back, a free block of at least the minimum size is kept
+    static size_t pageSize = 0;
+    if (pageSize == 0)
+        pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t keepEnd = (((uintptr_t) block) + BLOCK_MIN_SIZE + pageSize - 1) & ~(pageSize - 1);
+    if (keepEnd >= (uintptr_t) HeapEnd())
+        return;
+    size_t trimmed = (size_t) ((uintptr_t) HeapEnd() - keepEnd);
+
+    bool zeroed = BLOCKSIZE_ZEROED(*block);
+    RemoveFreeBlock(block);
+    if (HeapShrink(trimmed) == 0) {
+        dbgf("TRIMMED HEAP BY %zu\n", trimmed);
+        InitBlock(block, size - trimmed, BLOCK_FREE);
+        if (zeroed)
+            BLOCKSIZE_SET_ZEROED(*block);
+    }
+    InsertFreeBlock(block);
+}
+
+// last chance before the heap grows past the soft limit
+// the end of the heap is only trimmed if the callbacks freed enough, otherwise the heap would grow right back
+static BlockSize* RelievePressure(size_t size) {
+    HeapRunPressureCallbacks();
+    PurgeTick(true);
+    BlockSize* block = BestFit(size);
+    if (block)
+        TrimHeap();
+    return block;
+}
+
+// finds or creates a block with aligned payload size "size" and marks it used
+// if zeroed is not NULL, it is set to whether the payload past PAYLOAD_MIN_SIZE is known to be zero
+// in that case newly grown heap memory is not coalesced with the block above it, so it stays zero
+static void* AllocPayload(size_t size, bool* zeroed) {
     if (!didInitHeap) {
+        InitAllocator();
+        // fails if the region is too small or the hard limit was hit
+        BlockSize* first = HeapInit();
+        if (!first)
+            return NULL;
+        InsertFreeBlock(first);
         didInitHeap = true;
-        InsertFreeBlock(HeapInit());
     }
 
-    dbgf("ALIGNED SIZE = %zu\n", size);
     // find an appropriate block
     BlockSize* block = BestFit(size);
+    if (!block) {
+        TRACE_EVENT(index_miss, YHEAP_EVENT_INDEX_MISS, NULL, size);
+        if (HeapSoftLimitCrossed(size + BLOCK_AUXILIARY_SIZE))
+            block = RelievePressure(size);
+    }
     if (!block) {
         dbgf("GROWING HEAP!\n");
-        block = HeapGrow(size);
+        // growing is already a syscall, a good time to give back idle pages too
+        PurgeTick(false);
+        // a larger block must leave room to split off the rest
+        size_t growSize = size;
+        if (size < heapGrowMin)
+            growSize = heapGrowMin < size + BLOCK_MIN_SIZE ? size + BLOCK_MIN_SIZE : heapGrowMin;
+        block = HeapGrow(growSize);
+        if (!block && size < heapGrowMin)
+            block = HeapGrow(size);
+        // a region without a grow callback can run out, or the hard limit was reached
+        if (!block)
+            return NULL;
         assert(BLOCKSIZE_USAGE(*block) == BLOCK_FREE);
-
-        size_t sizeBeforeCoalescing = BLOCKSIZE_BYTES(*block);
         InsertFreeBlock(block);
-        BlockSize* coalesced = CoalesceBlocks(block);
-        size_t sizeAfterCoalescing = BLOCKSIZE_BYTES(*coalesced);
 
-        // if the newly grown block coalesced with above, split it
-        if (block != coalesced) {
-            block = coalesced;
-            assert(sizeBeforeCoalescing != sizeAfterCoalescing);
-        }
-        if (sizeBeforeCoalescing != sizeAfterCoalescing) {
+        // for ycalloc, keep the grown block apart from a dirty block above, so it stays zero
+        if (!zeroed) {
+            block = CoalesceBlocks(block);
             dbgf("block = %p\n", (void*)block);
-            InsertFreeBlock(coalesced);
-            SplitBlock(block, size);
+            InsertFreeBlock(block);
         }
+
+        // take what is needed, the rest stays free
+        if (BLOCKSIZE_BYTES(*block) >= size + BLOCK_MIN_SIZE)
+            SplitBlock(block, size);
+        else
+            RemoveFreeBlock(block);
     }
 
+    if (zeroed)
+        *zeroed = BLOCKSIZE_ZEROED(*block);
+
     // initialize block and return payload
     BlockNode* payload = InitBlock(block, size, BLOCK_USED);
     return payload;
 }
 
+// records a sampled allocation and marks its header, so yfree knows to untrack it
+static void ProfileSample(void* ptr, size_t size) {
+    if (ProfileRecordAlloc(ptr, size))
+        BLOCKSIZE_SET_SAMPLED(*(BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE));
+}
+
+void* ymalloc(size_t size) {
+    // nothing to allocate
+    if (size == 0)
+        return NULL;
+
+    // the sample rate comes from the environment, so read it before the first allocation is sampled
+    if (!didInitHeap)
+        InitAllocator();
+
+    // sampled allocations go in their own guarded page
+    if (GUARDED_SHOULD_SAMPLE()) {
+        void* ptr = GuardedAlloc(size);
+        if (ptr) {
+            TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, ptr, size);
+            return ptr;
+        }
+    }
+
+    if (size > PAYLOAD_MAX_SIZE)
+        return NULL;
+    size = TUNE_SIZE_CLASS(PAYLOAD_ALIGN(size));
+    dbgf("ALIGNED SIZE = %zu\n", size);
+    void* ptr = AllocPayload(size, NULL);
+    if (ptr) {
+        if (PROFILE_SHOULD_SAMPLE(size))
+            ProfileSample(ptr, size);
+        TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, ptr, size);
+    }
+    return ptr;
+}
+
 void yfree(void* ptr) {
     // nothing to free
     if (ptr == NULL)
         return;
 
+    if (GUARDED_OWNS(ptr)) {
+        TRACE_EVENT(free, YHEAP_EVENT_FREE, ptr, GuardedSize(ptr));
+        GuardedFree(ptr);
+        return;
+    }
+
     // coalesce adjacent blocks
     BlockSize* block = (BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE);
+    TRACE_EVENT(free, YHEAP_EVENT_FREE, ptr, BLOCKSIZE_BYTES(*block));
+    if (BLOCKSIZE_SAMPLED(*block))
+        ProfileRecordFree(ptr);
     InsertFreeBlock(CoalesceBlocks(block));
+    // a heap over the soft limit gives back its end as soon as that is free
+    if (heapOverSoftLimit)
+        TrimHeap();
+    // only set by large frees once the next tick is due, or while a tick has more blocks to look at
+    if (purgeTickDue)
+        PurgeTick(false);
+}
+
+void* yaligned_alloc(size_t alignment, size_t size) {
+    if (alignment <= HEAP_ALIGNMENT)
+        return ymalloc(size);
+    if ((alignment & (alignment - 1)) != 0 || size == 0 || size > PAYLOAD_MAX_SIZE)
+        return NULL;
+    size = PAYLOAD_ALIGN(size);
+    if (size > SIZE_MAX - alignment - BLOCK_MIN_SIZE)
+        return NULL;
+
+    // over allocate, so there is an aligned payload with room for a free block before it
+    // | header | leading free block ... | header | aligned payload (size) | footer | header | remainder ... |
+    size_t padded = size + alignment + BLOCK_MIN_SIZE;
+    uint8_t* ptr = AllocPayload(padded, NULL);
+    if (!ptr)
+        return NULL;
+
+    uint8_t* aligned = ptr;
+    if (((uintptr_t) ptr & (alignment - 1)) != 0)
+        aligned = (uint8_t*) (((uintptr_t) ptr + BLOCK_MIN_SIZE + alignment - 1) & ~(alignment - 1));
+    size_t gap = (size_t) (aligned - ptr);
+
+    BlockSize* block = (BlockSize*) (aligned - BLOCK_HEADER_SIZE);
+    InitBlock(block, padded - gap, BLOCK_USED);
+
+    // give back the space before and after the aligned block, as if it was freed
+    if (gap != 0) {
+        BlockSize* leading = (BlockSize*) (ptr - BLOCK_HEADER_SIZE);
+        InitBlock(leading, gap - BLOCK_AUXILIARY_SIZE, BLOCK_USED);
+        InsertFreeBlock(CoalesceBlocks(leading));
+    }
+    if (padded - gap >= size + BLOCK_MIN_SIZE) {
+        BlockSize* removed = SplitBlock(block, size);
+        InitBlock(block, size, BLOCK_USED);
+        InsertFreeBlock(CoalesceBlocks(removed));
+    }
+
+    if (PROFILE_SHOULD_SAMPLE(size))
+        ProfileSample(aligned, size);
+    TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, aligned, size);
+    return aligned;
+}
+
+ymalloc_small_cache_t ymalloc_small_cache;
+
+// carves a batch of used blocks for the class out of one heap block, so an empty class costs a single fit
+// | header | object | footer | header | object | footer | ... |
+// class sizes are multiples of 16, so every object has the alignment of the first, which is made 16
+// by asking for 8 extra bytes, they go to the last object, or else to a leading block given back to the heap
+void* ymalloc_small_refill(size_t cls) {
+    size_t size = (cls + 1) * 16;
+    size_t stride = size + BLOCK_AUXILIARY_SIZE;
+    size_t total = YMALLOC_SMALL_BATCH * stride - BLOCK_AUXILIARY_SIZE + HEAP_ALIGNMENT;
+    uint8_t* first = AllocPayload(total, NULL);
+    if (!first)
+        return yaligned_alloc(16, size);
+
+    size_t count = YMALLOC_SMALL_BATCH;
+    size_t lastSize = size + HEAP_ALIGNMENT;
+    BlockSize* leading = NULL;
+    if (((uintptr_t) first & 15) != 0) {
+        // the leading block shifts the rest by size + 24, which is 8 mod 16
+        leading = (BlockSize*) (first - BLOCK_HEADER_SIZE);
+        InitBlock(leading, size + HEAP_ALIGNMENT, BLOCK_USED);
+        first += stride + HEAP_ALIGNMENT;
+        count--;
+        lastSize = size;
+    }
+
+    for (size_t i = count - 1; i > 0; --i) {
+        uint8_t* header = first - BLOCK_HEADER_SIZE + i * stride;
+        void* obj = InitBlock(header, i == count - 1 ? lastSize : size, BLOCK_USED);
+        *(void**) obj = ymalloc_small_cache.head[cls];
+        ymalloc_small_cache.head[cls] = obj;
+    }
+    ymalloc_small_cache.count[cls] += count - 1;
+    InitBlock(first - BLOCK_HEADER_SIZE, size, BLOCK_USED);
+    // only once the objects after it have headers, so it can't coalesce into them
+    if (leading)
+        InsertFreeBlock(CoalesceBlocks(leading));
+
+    // the batch is sampled as a whole, one object stands in for it
+    if (PROFILE_SHOULD_SAMPLE(total))
+        ProfileSample(first, size);
+    TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, first, size);
+    return first;
+}
+
+// gives half of the cached objects back to the heap
+void yfree_small_flush(size_t cls) {
+    for (uint32_t n = ymalloc_small_cache.count[cls] / 2; n > 0; --n) {
+        void* obj = ymalloc_small_cache.head[cls];
+        ymalloc_small_cache.head[cls] = *(void**) obj;
+        ymalloc_small_cache.count[cls]--;
+        yfree(obj);
+    }
+}
+
+void yfree_sized(void* ptr, size_t size) {
+    // the header is still needed to coalesce, so the size is only checked
+#ifdef DEBUG
+    if (ptr != NULL && !GUARDED_OWNS(ptr))
+        assert(BLOCKSIZE_BYTES(*(BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE)) >= size);
+#else
+    (void) size;
+#endif
+    yfree(ptr);
 }
 
 void* ycalloc(size_t nmemb, size_t size) {
-    // NOTE: nmemb * size can overflow!
+    // nmemb * size can overflow
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
     size_t totSize = nmemb * size;
-    void* ptr = ymalloc(totSize);
-    if (ptr)
+    if (totSize == 0 || totSize > PAYLOAD_MAX_SIZE)
+        return NULL;
+
+    if (!didInitHeap)
+        InitAllocator();
+
+    // guarded pages are always zero
+    if (GUARDED_SHOULD_SAMPLE()) {
+        void* ptr = GuardedAlloc(totSize);
+        if (ptr) {
+            TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, ptr, totSize);
+            return ptr;
+        }
+    }
+
+    // only the free block links need clearing if the block is known to be zero,
+    // so large allocations don't fault in every page up front
+    bool zeroed;
+    size_t alignedSize = TUNE_SIZE_CLASS(PAYLOAD_ALIGN(totSize));
+    void* ptr = AllocPayload(alignedSize, &zeroed);
+    if (ptr) {
+        if (zeroed && totSize > PAYLOAD_MIN_SIZE)
+            totSize = PAYLOAD_MIN_SIZE;
         memset(ptr, 0, totSize);
+        if (PROFILE_SHOULD_SAMPLE(alignedSize))
+            ProfileSample(ptr, alignedSize);
+        TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, ptr, alignedSize);
+    }
     return ptr;
 }
 
+// reallocates by moving to a new block, the old block is kept if that fails
+static void* MoveAllocation(void* ptr, size_t oldSize, size_t size) {
+    void* new_ptr = ymalloc(size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, oldSize < size ? oldSize : size);
+        yfree(ptr);
+        TRACE_EVENT(realloc_moved, YHEAP_EVENT_REALLOC_MOVED, new_ptr, size);
+    }
+    return new_ptr;
+}
+
 void* yrealloc(void* ptr, size_t size) {
     // realloc nothing, simply malloc
     if (ptr == NULL)
         return ymalloc(size);
+    // aligning would wrap around, ptr is left as it is
+    if (size > PAYLOAD_MAX_SIZE)
+        return NULL;
+
+    // guarded allocations can't grow in place, always move them
+    if (GUARDED_OWNS(ptr))
+        return MoveAllocation(ptr, GuardedSize(ptr), size);
 
     // get the old and new sizes
     BlockSize* block = (BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE);
     size_t oldSize = BLOCKSIZE_BYTES(*block);
-    size = PAYLOAD_ALIGN(size);
+    size = TUNE_SIZE_CLASS(PAYLOAD_ALIGN(size));
     dbgf("OLD SIZE = %zu\n", oldSize);
     dbgf("ALIGNED SIZE = %zu\n", size);
 
     // same size, do nothing
-    if (size + BLOCK_MIN_SIZE > oldSize && size <= oldSize)
+    if (size + BLOCK_MIN_SIZE > oldSize && size <= oldSize) {
+        TRACE_EVENT(realloc_inplace, YHEAP_EVENT_REALLOC_INPLACE, ptr, oldSize);
         return ptr;
+    }
+
+    // resizing in place would drop the sampled mark, so let the profiler see a free and a new allocation
+    if (BLOCKSIZE_SAMPLED(*block))
+        return MoveAllocation(ptr, oldSize, size);
 
     // lower size, shrink block
     if (size < oldSize) {
@@ -365,6 +696,7 @@ void* yrealloc(void* ptr, size_t size) {
         BlockSize* removed = SplitBlock(block, size);
         InitBlock(block, size, BLOCK_USED);
         InsertFreeBlock(CoalesceBlocks(removed));
+        TRACE_EVENT(realloc_inplace, YHEAP_EVENT_REALLOC_INPLACE, ptr, size);
         return ptr;
     }
 
@@ -389,12 +721,14 @@ void* yrealloc(void* ptr, size_t size) {
             RemoveFreeBlock(belowHeader);
 
             InitBlock(block, size, BLOCK_USED);
+            TRACE_EVENT(realloc_inplace, YHEAP_EVENT_REALLOC_INPLACE, ptr, size);
             return ptr;
         }
 
         if (size + BLOCK_MIN_SIZE <= exactSize) {
             // remove from free list (split)
             size_t splitSize = size - oldSize;
+            bool belowZeroed = BLOCKSIZE_ZEROED(*belowHeader);
             assert(size >= oldSize);
             dbgf("SPLITTING size = %zu\n", size);
             dbgf("SPLITTING oldSize = %zu\n", oldSize);
@@ -409,8 +743,11 @@ void* yrealloc(void* ptr, size_t size) {
             BlockSize* shrunk = (BlockSize*) (((uint8_t*) belowHeader) + splitSize);
             InitBlock(shrunk, newSize, BLOCK_FREE);
             InitBlock(block, size, BLOCK_USED);
+            if (belowZeroed)
+                BLOCKSIZE_SET_ZEROED(*shrunk);
 
             InsertFreeBlock(shrunk);
+            TRACE_EVENT(realloc_inplace, YHEAP_EVENT_REALLOC_INPLACE, ptr, size);
             return ptr;
         }
         // below block too small
@@ -420,8 +757,91 @@ void* yrealloc(void* ptr, size_t size) {
     // aboveSize + oldSize + belowSize <= newSize, then coalesce and memmove
 
     // if the old block cannot be reused in any way, need to reallocate and move
-    void* new_ptr = ymalloc(size);
-    memcpy(new_ptr, ptr, oldSize);
+    return MoveAllocation(ptr, oldSize, size);
+}
+
+// sums the used and total bytes of the blocks around block, walking up with the footers and down with the headers
+static bool InSparseRegion(BlockSize* block) {
+    size_t used = BLOCKSIZE_BYTES(*block) + BLOCK_AUXILIARY_SIZE;
+    size_t total = used;
+
+    uint8_t* begin = HeapBegin();
+    uint8_t* curr = (uint8_t*) block;
+    for (int i = 0; i < RELOCATE_BLOCKS_MAX && curr > begin && (uint8_t*) block - curr < RELOCATE_WINDOW; ++i) {
+        BlockSize footer = *(BlockSize*) (curr - BLOCK_HEADER_SIZE);
+        size_t size = BLOCKSIZE_BYTES(footer) + BLOCK_AUXILIARY_SIZE;
+        curr -= size;
+        total += size;
+        if (BLOCKSIZE_USAGE(footer) != BLOCK_FREE)
+            used += size;
+    }
+
+    uint8_t* end = HeapEnd();
+    curr = ((uint8_t*) block) + BLOCKSIZE_BYTES(*block) + BLOCK_AUXILIARY_SIZE;
+    for (int i = 0; i < RELOCATE_BLOCKS_MAX && curr < end && curr - (uint8_t*) block < RELOCATE_WINDOW; ++i) {
+        BlockSize header = *(BlockSize*) curr;
+        size_t size = BLOCKSIZE_BYTES(header) + BLOCK_AUXILIARY_SIZE;
+        curr += size;
+        total += size;
+        if (BLOCKSIZE_USAGE(header) != BLOCK_FREE)
+            used += size;
+    }
+    return used * 100 < total * RELOCATE_SPARSE_PERCENT;
+}
+
+// nothing but free space after block, so moving it lets the heap be trimmed
+static bool AtHeapTop(BlockSize* block) {
+    uint8_t* next = ((uint8_t*) block) + BLOCKSIZE_BYTES(*block) + BLOCK_AUXILIARY_SIZE;
+    if (next >= (uint8_t*) HeapEnd())
+        return true;
+    BlockSize header = *(BlockSize*) next;
+    return BLOCKSIZE_USAGE(header) == BLOCK_FREE &&
+        next + BLOCKSIZE_BYTES(header) + BLOCK_AUXILIARY_SIZE >= (uint8_t*) HeapEnd();
+}
+
+// blocks don't record the alignment they were allocated with (16 for ymalloc_small and operator new,
+// more for yaligned_alloc), so the target keeps every alignment the payload happens to have
+static BlockSize* RelocationTarget(BlockSize* block) {
+    uintptr_t payload = (uintptr_t) block + BLOCK_HEADER_SIZE;
+    return LowestFreeBlock(BLOCKSIZE_BYTES(*block), block, payload & -payload);
+}
+
+int ymalloc_should_relocate(void* ptr) {
+    // guarded allocations have a page each, there is nothing to compact
+    if (ptr == NULL || !didInitHeap || GUARDED_OWNS(ptr))
+        return 0;
+    BlockSize* block = (BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE);
+    if (!InSparseRegion(block) && !AtHeapTop(block))
+        return 0;
+    return RelocationTarget(block) != NULL;
+}
+
+void* yrealloc_compact(void* ptr) {
+    if (ptr == NULL || !didInitHeap || GUARDED_OWNS(ptr))
+        return ptr;
+    BlockSize* block = (BlockSize*) (((uint8_t*) ptr) - BLOCK_HEADER_SIZE);
+    size_t size = BLOCKSIZE_BYTES(*block);
+    BlockSize* target = RelocationTarget(block);
+    if (!target)
+        return ptr;
+
+    // take the target like BestFit would, it is above block so freeing block can't touch it
+    if (BLOCKSIZE_BYTES(*target) == size)
+        RemoveFreeBlock(target);
+    else
+        SplitBlock(target, size);
+    void* new_ptr = InitBlock(target, size, BLOCK_USED);
+    memcpy(new_ptr, ptr, size);
+    bool sampled = BLOCKSIZE_SAMPLED(*block);
+    bool atTop = AtHeapTop(block);
+    TRACE_EVENT(malloc, YHEAP_EVENT_MALLOC, new_ptr, size);
     yfree(ptr);
+    // the profiler sees a free and a new allocation, as when yrealloc moves a sampled block
+    if (sampled)
+        ProfileSample(new_ptr, size);
+    TRACE_EVENT(realloc_moved, YHEAP_EVENT_REALLOC_MOVED, new_ptr, size);
+    // the old block was the last one in use, so the end of the heap is free now
+    if (atTop)
+        TrimHeap();
     return new_ptr;
 }
@@ -3,11 +3,204 @@
 #ifndef YMALLOC_H
 #define YMALLOC_H
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #include "heap.h"
+#include <stdint.h>
 
 void* ymalloc(size_t size);
 void yfree(void* ptr);
 void* ycalloc(size_t nmemb, size_t size);
 void* yrealloc(void* ptr, size_t size);
+// alignment must be a power of two, returns NULL otherwise
+void* yaligned_alloc(size_t alignment, size_t size);
+// size must be at most the size that was allocated
+void yfree_sized(void* ptr, size_t size);
+
+// hints for compacting movable objects, such as those behind handles or in a moving collector
+// returns nonzero if ptr sits in a sparsely used part of the heap (or at its end) and a lower addressed free block fits it
+int ymalloc_should_relocate(void* ptr);
+// moves ptr to the lowest addressed close fit in the free index and trims the end of the heap,
+// returns the new pointer, or ptr if there is no better place for it
+// the new pointer is at least as aligned as ptr, so aligned and small objects keep their alignment
+void* yrealloc_compact(void* ptr);
+
+// inline fast path for small fixed size objects, sizes up to YMALLOC_SMALL_MAX are rounded to 16 byte classes
+// and 16 byte aligned (unlike ymalloc), larger sizes go to ymalloc
+// freed objects are kept in a per class cache and handed out again without entering the allocator,
+// with a constant size the class and the range check are resolved at compile time
+// objects may be freed with yfree (or yrealloc'd), but yfree_small only takes objects from ymalloc_small,
+// with a size in the same class, cached objects bypass guarded sampling and the event hook,
+// the profiler samples a whole batch through one object, which is never cached again
+#define YMALLOC_SMALL_MAX 256
+#define YMALLOC_SMALL_CLASSES (YMALLOC_SMALL_MAX / 16)
+#define YMALLOC_SMALL_BATCH 32      // objects carved from one heap block when a class is empty
+#define YMALLOC_SMALL_CACHE_MAX 128 // half the cached objects of a class are freed past this
+
+typedef struct {
+    void* head[YMALLOC_SMALL_CLASSES];
+    uint32_t count[YMALLOC_SMALL_CLASSES];
+} ymalloc_small_cache_t;
+
+extern ymalloc_small_cache_t ymalloc_small_cache;
+void* ymalloc_small_refill(size_t cls);
+void yfree_small_flush(size_t cls);
+
+static inline void* ymalloc_small(size_t size) {
+    if (size == 0 || size > YMALLOC_SMALL_MAX)
+        return ymalloc(size);
+    size_t cls = (size - 1) / 16;
+    void* ptr = ymalloc_small_cache.head[cls];
+    if (__builtin_expect(ptr == NULL, 0))
+        return ymalloc_small_refill(cls);
+    ymalloc_small_cache.head[cls] = *(void**) ptr;
+    ymalloc_small_cache.count[cls]--;
+    return ptr;
+}
+
+static inline void yfree_small(void* ptr, size_t size) {
+    if (ptr == NULL || size == 0 || size > YMALLOC_SMALL_MAX) {
+        yfree(ptr);
+        return;
+    }
+    // the object the profiler sampled for its batch goes back to the heap, so the profiler sees the free
+    if (__builtin_expect(BLOCKSIZE_SAMPLED(*(BlockSize*) ((uint8_t*) ptr - BLOCK_HEADER_SIZE)), 0)) {
+        yfree(ptr);
+        return;
+    }
+    size_t cls = (size - 1) / 16;
+    *(void**) ptr = ymalloc_small_cache.head[cls];
+    ymalloc_small_cache.head[cls] = ptr;
+    if (__builtin_expect(++ymalloc_small_cache.count[cls] > YMALLOC_SMALL_CACHE_MAX, 0))
+        yfree_small_flush(cls);
+}
+
+// place one in every rate allocations (on average) in its own guarded page, 0 disables sampling
+// overflows, use-after-frees and double frees are reported with allocation and free stack traces
+// can also be set with the YMALLOC_GUARDED_SAMPLE_RATE environment variable
+void yguarded_set_sample_rate(uint32_t rate);
+
+// sample allocations every sampleBytes bytes on average (0 for the default 512 KiB) and record their stacks
+// can also be started with the YMALLOC_PROFILE_SAMPLE environment variable
+int yprofile_start(size_t sampleBytes);
+void yprofile_stop(void);
+// writes a pprof compatible profile of the in use and allocated bytes of each sampled stack
+// returns 0 on success
+int yprofile_dump(const char* path);
+// dumps a profile to path whenever signo is received
+// can also be set with the YMALLOC_PROFILE_SIGNAL and YMALLOC_PROFILE_PATH environment variables
+int yprofile_dump_on_signal(int signo, const char* path);
+
+// called for every heap block in address order with its payload and size, return nonzero to stop
+// the callback must not allocate or free
+typedef int (*yheap_walk_fn)(void* payload, size_t size, int isFree, void* arg);
+// returns the first nonzero callback result, or 0 once every block was visited
+int yheap_walk(yheap_walk_fn fn, void* arg);
+// writes the block layout and free index shape to path in the binary format read by snapshot.rb
+// returns 0 on success
+int yheap_snapshot(const char* path);
+// same as yheap_snapshot, but written by a forked child from a copy on write image of the heap,
+// so the caller is only paused for the fork, returns the child pid (to wait on) or -1
+int yheap_snapshot_fork(const char* path);
+
+// run the heap inside [base, base+len) instead of the data segment, so no syscalls are made to get memory
+// must be called before the first allocation, returns 0 on success
+int yheap_init_region(void* base, size_t len);
+// called when the region is used up to make at least size more bytes available starting at end
+// (the region must stay contiguous), returns the number of bytes added or 0 on failure
+typedef size_t (*yheap_grow_fn)(void* end, size_t size, void* arg);
+// without a grow callback, allocations fail once the region is used up
+void yheap_set_grow_callback(yheap_grow_fn fn, void* arg);
+
+// keep the heap in a file, creating it if needed, reserving maxSize bytes of address space (0 for 64 GiB)
+// an existing file is mapped back at any address with all of its allocations, changes reach the file as they are made
+// (the mapping is shared) and the file is consistent whenever no allocator call is running, even without yheap_sync
+// must be called before the first allocation, returns 0 on success
+// guarded sampling is off for a heap in a file, and pointers stored in the heap should be yheap_offset values
+int yheap_open_file(const char* path, size_t maxSize);
+// flushes the file to disk, so it survives a system crash as well, returns 0 on success
+int yheap_sync(void);
+// an allocation to find the rest of the data from when the file is reopened
+void* yheap_root(void);
+void yheap_set_root(void* ptr);
+// convert between pointers and offsets that stay valid wherever the heap is mapped, NULL is 0
+size_t yheap_offset(void* ptr);
+void* yheap_pointer(size_t offset);
+
+// pages of free blocks that stay unused for decayMs milliseconds (default 10 s) are given back to the kernel
+// checked on large frees and heap growth, 0 disables it, can also be set with the YMALLOC_DECAY_MS environment variable
+// has no effect on a region or file heap
+void yheap_set_decay(size_t decayMs);
+// checks for expired free pages now, for programs that want to drive the decay from their own timer
+void yheap_purge_tick(void);
+// gives back the pages of every free block right away
+void yheap_purge(void);
+
+// limits on the heap size in bytes, 0 for none, returns 0 on success
+// before the heap grows past the soft limit the pressure callbacks run, free pages are given back
+// and the end of the heap is trimmed, then the allocation is retried
+// the heap never grows past the hard limit, allocations that would need it to return NULL
+int yheap_set_limits(size_t soft, size_t hard);
+// heapSize is the current heap size, callbacks may free memory (and allocate, without running the callbacks again)
+typedef void (*yheap_pressure_fn)(size_t heapSize, size_t softLimit, void* arg);
+// at most 8 callbacks can be registered, returns 0 on success
+int yheap_add_pressure_callback(yheap_pressure_fn fn, void* arg);
+void yheap_remove_pressure_callback(yheap_pressure_fn fn, void* arg);
+
+// allocator events, also available as USDT probes named after the event (ymalloc:malloc, ymalloc:split, ...)
+typedef enum {
+    YHEAP_EVENT_MALLOC,          // ptr was allocated with size bytes (including calloc and aligned allocations)
+    YHEAP_EVENT_FREE,            // ptr with size bytes was freed
+    YHEAP_EVENT_REALLOC_INPLACE, // ptr was resized to size bytes without moving
+    YHEAP_EVENT_REALLOC_MOVED,   // a block was moved to ptr with size bytes, along with a malloc and a free event
+    YHEAP_EVENT_SPLIT,           // size bytes at ptr were split off the end of a block, they stay free if the block was free,
+                                 // the end of a used block (shrinking realloc, aligned alloc) is freed right after
+    YHEAP_EVENT_COALESCE,        // free blocks were merged into ptr with size bytes
+    YHEAP_EVENT_GROW,            // the heap grew by size bytes at ptr
+    YHEAP_EVENT_TRIM,            // size bytes at ptr were given back from the end of the heap
+    YHEAP_EVENT_INDEX_MISS,      // no free block fit size bytes, ptr is NULL
+} yheap_event;
+// called on every event, so it should be quick, and must not allocate or free
+typedef void (*yheap_event_fn)(yheap_event event, void* ptr, size_t size, void* arg);
+// a single hook, replacing any previous one, NULL removes it
+void yheap_set_event_hook(yheap_event_fn fn, void* arg);
+
+// records the size and lifetime of every allocation, and writes them to path at exit in the format read by tune.rb
+// uses the event hook, so it replaces any hook that was set, can also be started with the YMALLOC_TUNE_PROFILE environment variable
+int ytune_start(const char* path);
+// writes what was recorded so far, returns 0 on success
+int ytune_dump(const char* path);
+// loads size classes and heap thresholds written by tune.rb, returns 0 on success
+// the initial heap size only applies if loaded before the first allocation, as with the YMALLOC_CONFIG environment variable
+int ytune_load(const char* path);
+
+// fixed size object pools, packed densely in chunks from the heap without per object headers
+typedef struct ypool ypool;
+typedef void (*ypool_init_fn)(void* obj, void* arg);
+typedef struct {
+    size_t objsize;   // object size after rounding up to the alignment
+    size_t live;      // objects currently allocated
+    size_t highWater; // most objects ever allocated at once
+    size_t chunks;    // chunks taken from the heap
+    size_t allocs;
+    size_t frees;
+} ypool_stats;
+
+// align must be a power of two, 0 for the heap alignment, returns NULL on failure
+ypool* ypool_create(size_t objsize, size_t align);
+// fn is called on each object before ypool_alloc returns it
+void ypool_set_init(ypool* pool, ypool_init_fn fn, void* arg);
+// reuses the most recently freed object first
+void* ypool_alloc(ypool* pool);
+void ypool_free(ypool* pool, void* obj);
+// frees every chunk, objects still allocated become invalid
+void ypool_destroy(ypool* pool);
+void ypool_get_stats(const ypool* pool, ypool_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // YMALLOC_H
@@ -0,0 +1,138 @@
+// external header api for C++
+// ym::allocator<T> for containers and ym::heap_resource() for std::pmr containers
+// (the namespace can't be called ymalloc, that name is taken by the function)
+// define YMALLOC_REPLACE_OPERATOR_NEW before including this header in exactly one translation unit
+// to route the global operator new and delete (including sized and aligned overloads) to ymalloc
+// NOTE: like the C api, none of this is thread safe
+
+#ifndef YMALLOC_HPP
+#define YMALLOC_HPP
+
+#include "ymalloc.h"
+
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+namespace ym {
+
+namespace detail {
+
+// plain operator new passes 0, which still has to be aligned to __STDCPP_DEFAULT_NEW_ALIGNMENT__ (16)
+inline std::size_t new_alignment(std::size_t alignment) noexcept {
+    return alignment == 0 ? __STDCPP_DEFAULT_NEW_ALIGNMENT__ : alignment;
+}
+
+// ymalloc_small objects are 16 byte aligned, larger ymalloc blocks only 8
+inline bool is_small(std::size_t size, std::size_t alignment) noexcept {
+    return alignment <= HEAP_ALIGNMENT || (alignment <= 16 && size <= YMALLOC_SMALL_MAX);
+}
+
+inline void* allocate(std::size_t size, std::size_t alignment) noexcept {
+    // operator new and memory resources must return a unique pointer for size 0
+    if (size == 0)
+        size = 1;
+    alignment = new_alignment(alignment);
+    return is_small(size, alignment) ? ymalloc_small(size) : yaligned_alloc(alignment, size);
+}
+
+// sizes always come back with the alignment they were allocated with, so small objects go back to the cache
+inline void deallocate(void* ptr, std::size_t size, std::size_t alignment) noexcept {
+    if (size == 0)
+        size = 1;
+    if (is_small(size, new_alignment(alignment)))
+        yfree_small(ptr, size);
+    else
+        yfree_sized(ptr, size);
+}
+
+// calls the new handler until it gives up, like the default operator new
+inline void* allocate_or_throw(std::size_t size, std::size_t alignment) {
+    for (;;) {
+        void* ptr = allocate(size, alignment);
+        if (ptr)
+            return ptr;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+} // namespace detail
+
+template <typename T>
+struct allocator {
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <typename U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T*>(detail::allocate_or_throw(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        detail::deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+// there is a single heap, so every allocator is interchangeable
+template <typename T, typename U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept { return true; }
+template <typename T, typename U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept { return false; }
+
+class heap_memory_resource : public std::pmr::memory_resource {
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::allocate_or_throw(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        detail::deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const heap_memory_resource*>(&other) != nullptr;
+    }
+};
+
+inline std::pmr::memory_resource* heap_resource() noexcept {
+    static heap_memory_resource resource;
+    return &resource;
+}
+
+} // namespace ym
+
+#ifdef YMALLOC_REPLACE_OPERATOR_NEW
+
+// replacement functions can't be inline, so these are only defined where requested
+
+void* operator new(std::size_t size) { return ym::detail::allocate_or_throw(size, 0); }
+void* operator new[](std::size_t size) { return ym::detail::allocate_or_throw(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return ym::detail::allocate(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return ym::detail::allocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t al) { return ym::detail::allocate_or_throw(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return ym::detail::allocate_or_throw(size, static_cast<std::size_t>(al)); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return ym::detail::allocate(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return ym::detail::allocate(size, static_cast<std::size_t>(al)); }
+
+void operator delete(void* ptr) noexcept { yfree(ptr); }
+void operator delete[](void* ptr) noexcept { yfree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { yfree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { yfree(ptr); }
+void operator delete(void* ptr, std::size_t size) noexcept { ym::detail::deallocate(ptr, size, 0); }
+void operator delete[](void* ptr, std::size_t size) noexcept { ym::detail::deallocate(ptr, size, 0); }
+void operator delete(void* ptr, std::align_val_t) noexcept { yfree(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { yfree(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { yfree(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { yfree(ptr); }
+void operator delete(void* ptr, std::size_t size, std::align_val_t) noexcept { yfree_sized(ptr, size); }
+void operator delete[](void* ptr, std::size_t size, std::align_val_t) noexcept { yfree_sized(ptr, size); }
+
+#endif // YMALLOC_REPLACE_OPERATOR_NEW
+
+#endif // YMALLOC_HPP
@@ -0,0 +1,59 @@
+// operator new, ym::allocator and the memory resource honor the default new alignment
+#define YMALLOC_REPLACE_OPERATOR_NEW
+#include "ymalloc.hpp"
+#include "check.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static bool Aligned(const void* ptr, std::size_t alignment) {
+    return (reinterpret_cast<std::uintptr_t>(ptr) & (alignment - 1)) == 0;
+}
+
+struct alignas(64) Line {
+    char bytes[64];
+};
+
+int main(void) {
+    const std::size_t defaultAlign = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    std::vector<void*> held;
+
+    // every size the small cache serves and a few past it, with objects kept alive so blocks land at odd offsets
+    for (std::size_t size = 1; size <= 600; size += 7) {
+        char* a = new char[size];
+        CHECK(Aligned(a, defaultAlign));
+        std::memset(a, 0xab, size);
+        held.push_back(a);
+        long double* b = new long double(1.0L);
+        CHECK(Aligned(b, alignof(long double)));
+        CHECK(Aligned(b, defaultAlign));
+        held.push_back(b);
+    }
+    for (std::size_t i = 0; i < held.size(); i += 2) {
+        delete[] static_cast<char*>(held[i]);
+        delete static_cast<long double*>(held[i + 1]);
+    }
+
+    Line* line = new Line;
+    CHECK(Aligned(line, alignof(Line)));
+    delete line;
+
+    ym::allocator<long double> alloc;
+    for (std::size_t n = 1; n < 64; ++n) {
+        long double* p = alloc.allocate(n);
+        CHECK(Aligned(p, defaultAlign));
+        alloc.deallocate(p, n);
+    }
+
+    std::pmr::memory_resource* resource = ym::heap_resource();
+    for (std::size_t size = 1; size <= 1024; size *= 2) {
+        void* p = resource->allocate(size, defaultAlign);
+        CHECK(Aligned(p, defaultAlign));
+        void* q = resource->allocate(size, 256);
+        CHECK(Aligned(q, 256));
+        resource->deallocate(q, size, 256);
+        resource->deallocate(p, size, defaultAlign);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define DIRT 0xA5
+#define BIG (1 << 20)
+
+static size_t HeapBytes(void) {
+    return (size_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin());
+}
+
+static BlockSize* Header(void* ptr) {
+    return (BlockSize*) ((uint8_t*) ptr - BLOCK_HEADER_SIZE);
+}
+
+static BlockSize* NextHeader(void* ptr) {
+    return (BlockSize*) ((uint8_t*) ptr + BLOCKSIZE_BYTES(*Header(ptr)) + BLOCK_HEADER_SIZE);
+}
+
+static void CheckZero(void* ptr, size_t size) {
+    CHECK(ptr != NULL);
+    uint8_t* bytes = ptr;
+    for (size_t i = 0; i < size; ++i)
+        CHECK(bytes[i] == 0);
+}
+
+static void* Dirty(void* ptr, size_t size) {
+    CHECK(ptr != NULL);
+    memset(ptr, DIRT, size);
+    return ptr;
+}
+
+// frees a dirty block between two used ones and purges it, so it is a known zeroed free block
+static void* PurgedBlock(size_t size) {
+    void* block = Dirty(ymalloc(size), size);
+    CHECK(ymalloc(64) != NULL);
+    yfree(block);
+    yheap_purge();
+    CHECK(BLOCKSIZE_USAGE(*Header(block)) == BLOCK_FREE && BLOCKSIZE_ZEROED(*Header(block)));
+    return block;
+}
+
+static void* slots[64];
+
+int main(void) {
+    // splitting a zeroed block, both parts stay zeroed
+    void* purged = PurgedBlock(BIG);
+    void* split = ycalloc(1, BIG / 2);
+    CHECK(split == purged);
+    CheckZero(split, BIG / 2);
+    CHECK(BLOCKSIZE_USAGE(*NextHeader(split)) == BLOCK_FREE && BLOCKSIZE_ZEROED(*NextHeader(split)));
+    void* rest = ycalloc(1, BIG / 4);
+    CHECK((BlockSize*) rest == NextHeader(split) + 1);
+    CheckZero(rest, BIG / 4);
+    Dirty(split, BIG / 2);
+    Dirty(rest, BIG / 4);
+
+    // a dirty block freed next to a zeroed one is no longer zeroed as a whole
+    void* dirty = Dirty(ymalloc(BIG / 8), BIG / 8);
+    CHECK((BlockSize*) dirty == NextHeader(rest) + 1);
+    CHECK(BLOCKSIZE_ZEROED(*NextHeader(dirty)));
+    yfree(dirty);
+    CHECK(BLOCKSIZE_USAGE(*Header(dirty)) == BLOCK_FREE && !BLOCKSIZE_ZEROED(*Header(dirty)));
+    void* merged = ycalloc(1, BIG / 8 + BIG / 16);
+    CHECK(merged == dirty);
+    CheckZero(merged, BIG / 8 + BIG / 16);
+    Dirty(merged, BIG / 8 + BIG / 16);
+
+    // growing in place takes from the zeroed block below, shrinking back leaves dirt behind in it
+    purged = PurgedBlock(BIG / 2);
+    uint8_t* inplace = Dirty(ymalloc(BIG / 2 - 4096), BIG / 2 - 4096);
+    CHECK((void*) inplace == purged);
+    CHECK(BLOCKSIZE_USAGE(*NextHeader(inplace)) == BLOCK_FREE && BLOCKSIZE_ZEROED(*NextHeader(inplace)));
+    CHECK(yrealloc(inplace, BIG / 2 - 2048) == inplace);
+    CHECK(inplace[BIG / 2 - 4097] == DIRT);
+    CHECK(BLOCKSIZE_USAGE(*NextHeader(inplace)) == BLOCK_FREE && BLOCKSIZE_ZEROED(*NextHeader(inplace)));
+    CheckZero(ycalloc(1, 1000), 1000);
+    Dirty(inplace, BIG / 2 - 2048);
+    CHECK(yrealloc(inplace, BIG / 2 - 4096) == inplace);
+    CHECK(!BLOCKSIZE_ZEROED(*NextHeader(inplace)));
+    // and growing into that dirty block again doesn't make the rest zeroed
+    CHECK(yrealloc(inplace, BIG / 2 - 3072) == inplace);
+    CHECK(BLOCKSIZE_USAGE(*NextHeader(inplace)) == BLOCK_FREE && !BLOCKSIZE_ZEROED(*NextHeader(inplace)));
+    CheckZero(ycalloc(1, 900), 900);
+
+    // the end of the heap is trimmed to a page boundary, memory above it is zero when the heap grows back
+    CHECK(yheap_set_limits(HeapBytes(), 0) == 0);
+    void* tail = Dirty(ymalloc(BIG), BIG);
+    size_t grownBytes = HeapBytes();
+    yfree(tail);
+    CHECK(HeapBytes() < grownBytes);
+    BlockSize* lastFooter = (BlockSize*) ((uint8_t*) HeapEnd() - BLOCK_HEADER_SIZE);
+    BlockSize* last = (BlockSize*) ((uint8_t*) lastFooter - BLOCKSIZE_BYTES(*lastFooter) - BLOCK_HEADER_SIZE);
+    CHECK(BLOCKSIZE_USAGE(*last) == BLOCK_FREE && !BLOCKSIZE_ZEROED(*last));
+    CHECK(yheap_set_limits(0, 0) == 0);
+    CheckZero(ycalloc(1, BIG), BIG);
+    CheckZero(ycalloc(1, BLOCKSIZE_BYTES(*last)), BLOCKSIZE_BYTES(*last));
+
+    // mixed frees and reallocations never leave stale data for ycalloc
+    for (int round = 0; round < 200; ++round) {
+        int i = (round * 37) % 64;
+        size_t size = 16 + (size_t) (round * 997) % 20000;
+        if (slots[i] && round % 3 == 0) {
+            slots[i] = yrealloc(slots[i], size);
+            Dirty(slots[i], size);
+            continue;
+        }
+        yfree(slots[i]);
+        slots[i] = ycalloc(1, size);
+        CheckZero(slots[i], size);
+        Dirty(slots[i], size);
+    }
+    for (int i = 0; i < 64; ++i)
+        yfree(slots[i]);
+    return 0;
+}
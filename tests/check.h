@@ -0,0 +1,17 @@
+// shared by the focused tests, each one is its own program run by make check
+// the allocator prints a trace to stdout in debug builds, so failures go to stderr
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#endif // CHECK_H
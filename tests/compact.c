@@ -0,0 +1,128 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SAME_SIZE 1000
+#define SAME_BLOCKS 8
+// 160 byte objects take 176 bytes of heap each, a tenth of the 17.6 MB heap relocation was measured on
+#define OBJECTS 10000
+#define OBJECT_SIZE 160
+#define KEEP_EVERY 10
+#define PASSES 20
+
+static size_t HeapBytes(void) {
+    return (size_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin());
+}
+
+static void* objects[OBJECTS];
+
+static uintptr_t Alignment(void* ptr) {
+    return (uintptr_t) ptr & -(uintptr_t) ptr;
+}
+
+// several free blocks of one size below an object aligned to align (0 for ymalloc),
+// it moves to the lowest one that keeps its alignment
+// the blocks with their spacers take an odd number of 8 byte words, so their alignments alternate
+static void CompactOverHoles(size_t align) {
+    void* same[SAME_BLOCKS];
+    void* spacers[SAME_BLOCKS];
+    for (int i = 0; i < SAME_BLOCKS; ++i) {
+        same[i] = ymalloc(SAME_SIZE);
+        spacers[i] = ymalloc(64);
+        CHECK(same[i] != NULL && spacers[i] != NULL);
+    }
+    // an aligned block may keep some of its padding, so it asks for less to still fit the holes
+    size_t size = align ? SAME_SIZE / 2 : SAME_SIZE;
+    char* top = align ? yaligned_alloc(align, size) : ymalloc(size);
+    CHECK(top != NULL);
+    memset(top, 0x42, size);
+    for (int i = SAME_BLOCKS - 1; i >= 0; --i)
+        yfree(same[i]);
+
+    size_t topSize = BLOCKSIZE_BYTES(*(BlockSize*) (top - BLOCK_HEADER_SIZE));
+    CHECK(SAME_SIZE == topSize || SAME_SIZE >= topSize + BLOCK_MIN_SIZE);
+    void* expected = top;
+    for (int i = SAME_BLOCKS - 1; i >= 0; --i) {
+        if (Alignment(same[i]) >= Alignment(top))
+            expected = same[i];
+    }
+    CHECK(ymalloc_should_relocate(top) == (expected != top));
+    char* moved = yrealloc_compact(top);
+    CHECK(moved == expected);
+    CHECK(Alignment(moved) >= (align ? align : HEAP_ALIGNMENT));
+    for (size_t i = 0; i < size; ++i)
+        CHECK(moved[i] == 0x42);
+    yfree(moved);
+    for (int i = 0; i < SAME_BLOCKS; ++i)
+        yfree(spacers[i]);
+}
+
+// each layout starts from the same heap
+static void RunChild(void (*step)(size_t), size_t arg) {
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        step(arg);
+        exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+    RunChild(CompactOverHoles, 0);
+    RunChild(CompactOverHoles, 16);
+    RunChild(CompactOverHoles, 64);
+
+    // with most small objects freed, compaction passes bring the heap down to about the live size
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = ymalloc(OBJECT_SIZE);
+        CHECK(objects[i] != NULL);
+    }
+    size_t live = 0;
+    for (int i = 0; i < OBJECTS; ++i) {
+        if (i % KEEP_EVERY != 0) {
+            yfree(objects[i]);
+            objects[i] = NULL;
+        }
+        else {
+            memset(objects[i], i & 0xFF, OBJECT_SIZE);
+            live += OBJECT_SIZE + BLOCK_AUXILIARY_SIZE;
+        }
+    }
+    size_t before = HeapBytes();
+    CHECK(before >= OBJECTS * (OBJECT_SIZE + BLOCK_AUXILIARY_SIZE));
+
+    for (int pass = 0; pass < PASSES; ++pass) {
+        int moves = 0;
+        // from the end of the heap down, so the top is freed and trimmed first
+        for (int i = OBJECTS - 1; i >= 0; --i) {
+            if (objects[i] && ymalloc_should_relocate(objects[i])) {
+                void* ptr = yrealloc_compact(objects[i]);
+                moves += ptr != objects[i];
+                objects[i] = ptr;
+            }
+        }
+        if (moves == 0)
+            break;
+    }
+    size_t after = HeapBytes();
+    printf("heap %zu -> %zu bytes, %zu live\n", before, after, live);
+    // the free list only looks at its first few fits, so it ends a little higher than the tree
+    CHECK(after < live + live / 4);
+    for (int i = 0; i < OBJECTS; ++i) {
+        if (objects[i]) {
+            uint8_t* bytes = objects[i];
+            for (int j = 0; j < OBJECT_SIZE; ++j)
+                CHECK(bytes[j] == (i & 0xFF));
+            yfree(objects[i]);
+        }
+    }
+    return 0;
+}
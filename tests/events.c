@@ -0,0 +1,128 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_EVENTS 256
+
+typedef struct {
+    yheap_event event;
+    uint8_t* ptr;
+    size_t size;
+} Event;
+
+static Event events[MAX_EVENTS];
+static int numEvents = 0;
+static int hookArg;
+
+static void RecordEvent(yheap_event event, void* ptr, size_t size, void* arg) {
+    CHECK(arg == &hookArg);
+    CHECK(numEvents < MAX_EVENTS);
+    events[numEvents++] = (Event) { event, ptr, size };
+}
+
+// returns the index of the first matching event, ptr NULL matches any pointer
+static int Find(yheap_event event, void* ptr) {
+    for (int i = 0; i < numEvents; ++i) {
+        if (events[i].event == event && (ptr == NULL || events[i].ptr == ptr))
+            return i;
+    }
+    return -1;
+}
+
+static int Expect(yheap_event event, void* ptr, size_t size) {
+    int i = Find(event, ptr);
+    CHECK(i >= 0);
+    CHECK(events[i].size == size);
+    return i;
+}
+
+static BlockSize Header(void* ptr) {
+    return *(BlockSize*) ((uint8_t*) ptr - BLOCK_HEADER_SIZE);
+}
+
+// a split event names a free block of its size, or the start of the free block it was merged into
+static void CheckSplit(int i) {
+    CHECK(events[i].event == YHEAP_EVENT_SPLIT);
+    BlockSize header = Header(events[i].ptr);
+    CHECK(BLOCKSIZE_USAGE(header) == BLOCK_FREE);
+    CHECK(BLOCKSIZE_BYTES(header) >= events[i].size);
+}
+
+int main(void) {
+    yfree(ymalloc(64));
+    yheap_set_event_hook(RecordEvent, &hookArg);
+
+    // a fit from a larger free block splits off the rest
+    uint8_t* p = ymalloc(1000);
+    CHECK(p != NULL);
+    int split = Find(YHEAP_EVENT_SPLIT, p + 1000 + BLOCK_AUXILIARY_SIZE);
+    CHECK(split >= 0);
+    CheckSplit(split);
+    CHECK(Expect(YHEAP_EVENT_MALLOC, p, 1000) > split);
+    CHECK(Find(YHEAP_EVENT_FREE, NULL) == -1);
+
+    // and freeing it merges the two again
+    numEvents = 0;
+    yfree(p);
+    Expect(YHEAP_EVENT_FREE, p, 1000);
+    int coalesce = Find(YHEAP_EVENT_COALESCE, p);
+    CHECK(coalesce >= 0);
+    CHECK(BLOCKSIZE_USAGE(Header(p)) == BLOCK_FREE && BLOCKSIZE_BYTES(Header(p)) == events[coalesce].size);
+
+    // growing into the free block below doesn't move
+    uint8_t* q = ymalloc(96);
+    numEvents = 0;
+    CHECK(yrealloc(q, 304) == q);
+    CHECK(numEvents == 1);
+    Expect(YHEAP_EVENT_REALLOC_INPLACE, q, 304);
+
+    // shrinking splits off the end of the used block, which is freed right after
+    numEvents = 0;
+    CHECK(yrealloc(q, 96) == q);
+    split = Find(YHEAP_EVENT_SPLIT, q + 96 + BLOCK_AUXILIARY_SIZE);
+    CHECK(split >= 0);
+    CheckSplit(split);
+    CHECK(Expect(YHEAP_EVENT_REALLOC_INPLACE, q, 96) > split);
+    CHECK(Find(YHEAP_EVENT_MALLOC, NULL) == -1 && Find(YHEAP_EVENT_FREE, NULL) == -1);
+
+    // a move is a malloc, a free and the move itself
+    uint8_t* pin = ymalloc(64);
+    numEvents = 0;
+    uint8_t* moved = yrealloc(q, 5000);
+    CHECK(moved != NULL && moved != q);
+    int malloced = Expect(YHEAP_EVENT_MALLOC, moved, 5000);
+    int freed = Expect(YHEAP_EVENT_FREE, q, 96);
+    CHECK(Expect(YHEAP_EVENT_REALLOC_MOVED, moved, 5000) > freed && freed > malloced);
+
+    // the unused end of an aligned allocation is split off and freed too
+    numEvents = 0;
+    uint8_t* aligned = yaligned_alloc(256, 1000);
+    CHECK(aligned != NULL && (uintptr_t) aligned % 256 == 0);
+    split = Find(YHEAP_EVENT_SPLIT, aligned + 1000 + BLOCK_AUXILIARY_SIZE);
+    CHECK(split >= 0);
+    CheckSplit(split);
+    CHECK(Expect(YHEAP_EVENT_MALLOC, aligned, 1000) > split);
+
+    // a request no free block fits misses the index and grows the heap
+    numEvents = 0;
+    uint8_t* big = ycalloc(1, 1 << 20);
+    CHECK(big != NULL);
+    int miss = Expect(YHEAP_EVENT_INDEX_MISS, NULL, 1 << 20);
+    CHECK(events[miss].ptr == NULL);
+    int grow = Find(YHEAP_EVENT_GROW, NULL);
+    CHECK(grow > miss && events[grow].size >= (1 << 20) + BLOCK_AUXILIARY_SIZE);
+    CHECK(Expect(YHEAP_EVENT_MALLOC, big, 1 << 20) > grow);
+
+    // nothing is recorded once the hook is removed
+    yheap_set_event_hook(NULL, NULL);
+    numEvents = 0;
+    yfree(big);
+    yfree(aligned);
+    yfree(moved);
+    yfree(pin);
+    yfree(ymalloc(100));
+    CHECK(numEvents == 0);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// with a rate of 1 every allocation that fits a page is guarded, each case runs in a child
+// so the faults can be observed from the outside
+
+#define SIZE 128
+
+static char report[1 << 16];
+
+// runs step with stderr going to report, returns the wait status
+static int RunChild(void (*step)(void)) {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        yguarded_set_sample_rate(1);
+        step();
+        exit(0);
+    }
+    close(fds[1]);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], report + len, sizeof(report) - 1 - len)) > 0)
+        len += (size_t) n;
+    report[len] = '\0';
+    close(fds[0]);
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    return status;
+}
+
+// the child was stopped by the fault, and the report names the access and where the block came from
+static void CheckKilled(int status, const char* what) {
+    CHECK(!(WIFEXITED(status) && WEXITSTATUS(status) == 0));
+    CHECK(strstr(report, what) != NULL);
+    CHECK(strstr(report, "allocated by:") != NULL);
+}
+
+// guarded allocations end at a page boundary, right before their guard page
+static void CheckGuarded(void* ptr, size_t size) {
+    CHECK(ptr != NULL);
+    CHECK(((uintptr_t) ptr + HEAP_ALIGN_UP(size)) % (uintptr_t) sysconf(_SC_PAGESIZE) == 0);
+}
+
+static uint8_t* SampledAlloc(size_t size) {
+    uint8_t* ptr = ymalloc(size);
+    CheckGuarded(ptr, size);
+    return ptr;
+}
+
+static void CheckPattern(uint8_t* ptr, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        CHECK(ptr[i] == (uint8_t) i);
+}
+
+static void Overflow(void) {
+    volatile uint8_t* ptr = SampledAlloc(SIZE);
+    ptr[SIZE - 1] = 1;
+    ptr[SIZE] = 1;
+}
+
+static void UseAfterFree(void) {
+    volatile uint8_t* ptr = SampledAlloc(SIZE);
+    ptr[0] = 1;
+    yfree((void*) ptr);
+    ptr[0] = 2;
+}
+
+static void DoubleFree(void) {
+    uint8_t* ptr = SampledAlloc(SIZE);
+    yfree(ptr);
+    yfree(ptr);
+}
+
+static void Contents(void) {
+    // pages are zero when reused, round robin goes through every slot many times
+    for (int i = 0; i < 200; ++i) {
+        uint8_t* dirty = SampledAlloc(SIZE);
+        memset(dirty, 0xA5, SIZE);
+        yfree(dirty);
+        uint8_t* zeroed = ycalloc(4, SIZE / 4);
+        CheckGuarded(zeroed, SIZE);
+        for (int j = 0; j < SIZE; ++j)
+            CHECK(zeroed[j] == 0);
+        memset(zeroed, 0xA5, SIZE);
+        yfree(zeroed);
+    }
+
+    // reallocations move between guarded pages, and to the heap once larger than a page
+    uint8_t* ptr = SampledAlloc(100);
+    for (int i = 0; i < 100; ++i)
+        ptr[i] = (uint8_t) i;
+    ptr = yrealloc(ptr, 200);
+    CheckGuarded(ptr, 200);
+    CheckPattern(ptr, 100);
+    ptr = yrealloc(ptr, 40);
+    CheckGuarded(ptr, 40);
+    CheckPattern(ptr, 40);
+    ptr = yrealloc(ptr, 2 * (size_t) sysconf(_SC_PAGESIZE));
+    CHECK(ptr != NULL);
+    CheckPattern(ptr, 40);
+    yfree(ptr);
+}
+
+int main(void) {
+    CheckKilled(RunChild(Overflow), "buffer overflow at 0x");
+    CheckKilled(RunChild(UseAfterFree), "use-after-free at 0x");
+    CHECK(strstr(report, "freed by:") != NULL);
+    CheckKilled(RunChild(DoubleFree), "double free at 0x");
+    CHECK(strstr(report, "freed by:") != NULL);
+
+    int status = RunChild(Contents);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(strstr(report, "ymalloc:") == NULL);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK (64 * 1024)
+#define MAX_CHUNKS 256
+
+static int trims = 0;
+static int grows = 0;
+
+static void CountEvents(yheap_event event, void* ptr, size_t size, void* arg) {
+    (void) ptr; (void) size; (void) arg;
+    if (event == YHEAP_EVENT_TRIM)
+        trims++;
+    if (event == YHEAP_EVENT_GROW)
+        grows++;
+}
+
+static int pressureCalls = 0;
+static size_t pressureHeapSize = 0;
+static size_t pressureSoftLimit = 0;
+// freed by the pressure callback when set
+static void* reserve = NULL;
+
+static void OnPressure(size_t heapSize, size_t softLimit, void* arg) {
+    CHECK(arg == &pressureCalls);
+    pressureCalls++;
+    pressureHeapSize = heapSize;
+    pressureSoftLimit = softLimit;
+    yfree(reserve);
+    reserve = NULL;
+}
+
+static size_t HeapBytes(void) {
+    return (size_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin());
+}
+
+static int LargestFree(void* payload, size_t size, int isFree, void* arg) {
+    (void) payload;
+    size_t* largest = arg;
+    if (isFree && size > *largest)
+        *largest = size;
+    return 0;
+}
+
+static void* chunks[MAX_CHUNKS];
+
+// allocates CHUNK sized blocks until the heap is larger than size, or allocations fail
+static int FillHeap(size_t size) {
+    int n = 0;
+    while (n < MAX_CHUNKS && HeapBytes() <= size) {
+        chunks[n] = ymalloc(CHUNK);
+        if (chunks[n] == NULL)
+            break;
+        n++;
+    }
+    return n;
+}
+
+static void FreeChunks(int n) {
+    for (int i = n - 1; i >= 0; --i)
+        yfree(chunks[i]);
+}
+
+int main(void) {
+    // sizes that would wrap around when aligned fail and leave the old allocation alone
+    char* p = ymalloc(100);
+    CHECK(p != NULL);
+    memset(p, 0x3C, 100);
+    CHECK(yrealloc(p, SIZE_MAX) == NULL);
+    CHECK(yrealloc(p, SIZE_MAX - 3) == NULL);
+    CHECK(yrealloc(p, PAYLOAD_MAX_SIZE + 1) == NULL);
+    CHECK(yaligned_alloc(64, SIZE_MAX) == NULL);
+    CHECK(ymalloc(SIZE_MAX) == NULL);
+    for (int i = 0; i < 100; ++i)
+        CHECK(p[i] == 0x3C);
+    p = yrealloc(p, 200);
+    CHECK(p != NULL && p[99] == 0x3C);
+    yfree(p);
+
+    CHECK(yheap_set_limits(2 * CHUNK, CHUNK) == -1);
+    yheap_set_event_hook(CountEvents, NULL);
+
+    // over the soft limit, a free end of the heap is given back
+    size_t soft = HeapBytes() + 4 * CHUNK;
+    CHECK(yheap_set_limits(soft, 0) == 0);
+    void* big = ymalloc(1 << 20);
+    CHECK(big != NULL);
+    CHECK(HeapBytes() > soft);
+    int before = trims;
+    yfree(big);
+    CHECK(trims == before + 1);
+    CHECK(HeapBytes() <= soft);
+
+    // unless someone else moved the break, then frees leave the heap end alone
+    big = ymalloc(1 << 20);
+    CHECK(big != NULL);
+    void* moved = sbrk(4096);
+    CHECK(moved != (void*) -1);
+    before = trims;
+    yfree(big);
+    for (int i = 0; i < 100; ++i)
+        yfree(ymalloc(64));
+    CHECK(trims == before);
+
+    // and once the break is back, the next free trims again
+    CHECK(sbrk(-4096) != (void*) -1);
+    yfree(ymalloc(64));
+    CHECK(trims == before + 1);
+
+    // crossing the soft limit runs the callbacks once, a request that still doesn't fit
+    // grows the heap without trimming its end first
+    CHECK(yheap_add_pressure_callback(OnPressure, &pressureCalls) == 0);
+    soft = HeapBytes() + 4 * CHUNK;
+    CHECK(yheap_set_limits(soft, 0) == 0);
+    int n = FillHeap(soft + 4 * CHUNK);
+    CHECK(pressureCalls == 1);
+    CHECK(pressureSoftLimit == soft && pressureHeapSize <= soft);
+    CHECK(HeapBytes() > soft);
+
+    // freeing below the limit again re-arms them
+    FreeChunks(n);
+    CHECK(HeapBytes() <= soft);
+    n = FillHeap(soft + 4 * CHUNK);
+    CHECK(pressureCalls == 2);
+    FreeChunks(n);
+
+    // memory freed by a callback is used instead of growing
+    CHECK(yheap_set_limits(0, 0) == 0);
+    size_t largest = 0;
+    yheap_walk(LargestFree, &largest);
+    reserve = ymalloc(largest + 4 * CHUNK);
+    CHECK(reserve != NULL);
+    CHECK(yheap_set_limits(HeapBytes(), 0) == 0);
+    int grew = grows;
+    void* fits = ymalloc(largest + CHUNK);
+    CHECK(fits != NULL && reserve == NULL);
+    CHECK(pressureCalls == 3);
+    CHECK(grows == grew);
+    yfree(fits);
+
+    // a request that doesn't fit after the callbacks doesn't trim the end it is about to grow into
+    void* tail = ymalloc(4 * CHUNK);
+    CHECK(tail != NULL);
+    void* pin = ymalloc(64);
+    yfree(tail);
+    CHECK(yheap_set_limits(HeapBytes(), 0) == 0);
+    before = trims;
+    grew = grows;
+    big = ymalloc(1 << 20);
+    CHECK(big != NULL);
+    CHECK(grows == grew + 1 && trims == before);
+    yfree(big);
+    yfree(pin);
+    yheap_remove_pressure_callback(OnPressure, &pressureCalls);
+
+    // the heap never grows past the hard limit, allocations that would need it fail
+    size_t hard = HeapBytes() + 8 * CHUNK;
+    CHECK(yheap_set_limits(0, hard) == 0);
+    n = FillHeap(SIZE_MAX);
+    CHECK(n < MAX_CHUNKS);
+    CHECK(HeapBytes() <= hard);
+    CHECK(ymalloc(CHUNK) == NULL);
+    CHECK(ymalloc(2 * hard) == NULL);
+    CHECK(ycalloc(1, CHUNK) == NULL);
+    // what is left still serves small requests
+    void* small = ymalloc(64);
+    CHECK(small != NULL);
+    yfree(small);
+    FreeChunks(n);
+    CHECK(ymalloc(CHUNK) != NULL);
+
+    CHECK(yheap_set_limits(0, 0) == 0);
+    yheap_set_event_hook(NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// a heap in a file can only be opened before the first allocation, so each step runs in a child
+
+#define PATH "/tmp/ymalloc_test_persist.heap"
+#define NUM_NODES 64
+
+typedef struct {
+    size_t next; // offset of the next node
+    int value;
+} Node;
+
+static void RunChild(void (*step)(void)) {
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        step();
+        exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static Node* Push(Node* head, int value) {
+    Node* node = ymalloc(sizeof(Node));
+    CHECK(node != NULL);
+    node->value = value;
+    node->next = yheap_offset(head);
+    return node;
+}
+
+// syncs once, then keeps allocating and exits without syncing again
+static void WriteUnsynced(void) {
+    CHECK(yheap_open_file(PATH, 0) == 0);
+    Node* head = Push(NULL, 0);
+    yheap_set_root(head);
+    CHECK(yheap_sync() == 0);
+    for (int i = 1; i < NUM_NODES; ++i) {
+        head = Push(head, i);
+        yheap_set_root(head);
+        // leave free blocks around so the free index changes too
+        yfree(ymalloc(100 + i));
+    }
+}
+
+static void ReadBack(void) {
+    CHECK(yheap_open_file(PATH, 0) == 0);
+    int expected = NUM_NODES - 1;
+    for (Node* node = yheap_root(); node != NULL; node = yheap_pointer(node->next))
+        CHECK(node->value == expected--);
+    CHECK(expected == -1);
+
+    // new allocations must not overlap the restored ones
+    Node* head = yheap_root();
+    for (int i = 0; i < 1000; ++i) {
+        uint8_t* ptr = ymalloc(1 + i % 300);
+        CHECK(ptr != NULL);
+        memset(ptr, 0xAB, 1 + i % 300);
+    }
+    for (int i = NUM_NODES - 1; head != NULL; head = yheap_pointer(head->next))
+        CHECK(head->value == i--);
+}
+
+// a file with a header but no heap yet, whose heap space holds old data
+static void CallocDirty(void) {
+    CHECK(yheap_open_file(PATH, 0) == 0);
+    for (int i = 0; i < 100; ++i) {
+        uint8_t* ptr = ycalloc(1, 4000);
+        CHECK(ptr != NULL);
+        for (size_t j = 0; j < 4000; ++j)
+            CHECK(ptr[j] == 0);
+    }
+}
+
+// a damaged file is refused, and the heap falls back to sbrk
+static void OpenFails(void) {
+    CHECK(yheap_open_file(PATH, 0) == -1);
+    CHECK(yheap_root() == NULL);
+    uint8_t* ptr = ymalloc(1000);
+    CHECK(ptr != NULL);
+    memset(ptr, 0x11, 1000);
+    yfree(ptr);
+}
+
+// cuts the file short of its recorded heap size
+static void TruncateFile(void) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    CHECK(truncate(PATH, (off_t) (2 * pageSize)) == 0);
+}
+
+// points the free index root (the third header word) past the end of the heap
+static void CorruptFreeRoot(void) {
+    int fd = open(PATH, O_RDWR);
+    CHECK(fd >= 0);
+    uint64_t words[3];
+    CHECK(pread(fd, words, sizeof(words), 0) == (ssize_t) sizeof(words));
+    CHECK(words[1] != 0);
+    words[2] = words[1] + 4096;
+    CHECK(pwrite(fd, words, sizeof(words), 0) == (ssize_t) sizeof(words));
+    close(fd);
+}
+
+static void WriteDirtyFile(void) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t heapLen = 1 << 20;
+    int fd = open(PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    uint8_t* buf = calloc(1, pageSize + heapLen);
+    CHECK(buf != NULL);
+    memcpy(buf, "YMHEAP1", 8);
+    memset(buf + pageSize, 0x5A, heapLen);
+    CHECK(write(fd, buf, pageSize + heapLen) == (ssize_t) (pageSize + heapLen));
+    close(fd);
+    free(buf);
+}
+
+int main(void) {
+    unlink(PATH);
+    RunChild(WriteUnsynced);
+    RunChild(ReadBack);
+
+    CorruptFreeRoot();
+    RunChild(OpenFails);
+    unlink(PATH);
+    RunChild(WriteUnsynced);
+    TruncateFile();
+    RunChild(OpenFails);
+
+    WriteDirtyFile();
+    RunChild(CallocDirty);
+    unlink(PATH);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static void Fill(void* obj, void* arg) {
+    memset(obj, *(int*) arg, 40);
+}
+
+int main(void) {
+    // sizes whose chunks would overflow are rejected instead of wrapping to a tiny chunk
+    CHECK(ypool_create(SIZE_MAX, 0) == NULL);
+    CHECK(ypool_create(SIZE_MAX - 100, 0) == NULL);
+    CHECK(ypool_create(SIZE_MAX / 8, 0) == NULL);
+    CHECK(ypool_create(100, (size_t) 1 << 62) == NULL);
+    CHECK(ypool_create(100, 24) == NULL);
+
+    // large aligned objects
+    ypool* pool = ypool_create(1 << 20, 64);
+    CHECK(pool != NULL);
+    for (int i = 0; i < 10; ++i) {
+        uint8_t* obj = ypool_alloc(pool);
+        CHECK(obj != NULL && ((uintptr_t) obj & 63) == 0);
+        memset(obj, i, 1 << 20);
+    }
+    ypool_destroy(pool);
+
+    // freed objects are reused LIFO and the stats follow along
+    int pattern = 0x5A;
+    pool = ypool_create(40, 0);
+    CHECK(pool != NULL);
+    ypool_set_init(pool, Fill, &pattern);
+    void* objs[1000];
+    for (int i = 0; i < 1000; ++i) {
+        objs[i] = ypool_alloc(pool);
+        CHECK(objs[i] != NULL && ((uint8_t*) objs[i])[39] == 0x5A);
+        for (int j = 0; j < i; j += 97)
+            CHECK(objs[i] != objs[j]);
+    }
+    ypool_free(pool, objs[10]);
+    ypool_free(pool, objs[20]);
+    CHECK(ypool_alloc(pool) == objs[20]);
+    CHECK(ypool_alloc(pool) == objs[10]);
+
+    ypool_stats stats;
+    ypool_get_stats(pool, &stats);
+    CHECK(stats.objsize == 40 && stats.live == 1000 && stats.highWater == 1000);
+    CHECK(stats.allocs == 1002 && stats.frees == 2 && stats.chunks >= 1);
+    ypool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH "/tmp/ymalloc_test_profile.heap"
+#define SIGNAL_PATH "/tmp/ymalloc_test_profile_signal.heap"
+#define RATE 4096
+#define OBJECTS 20000
+#define OBJECT_SIZE 256
+
+typedef struct {
+    int64_t inuseCount, inuseBytes, allocCount, allocBytes;
+} Counts;
+
+// reads the header, checks every stack line and that they add up to it
+static Counts ReadProfile(const char* path) {
+    FILE* fp = fopen(path, "r");
+    CHECK(fp != NULL);
+    Counts total;
+    size_t rate;
+    CHECK(fscanf(fp, "heap profile: %" SCNd64 ": %" SCNd64 " [%" SCNd64 ": %" SCNd64 "] @ heap_v2/%zu\n",
+        &total.inuseCount, &total.inuseBytes, &total.allocCount, &total.allocBytes, &rate) == 5);
+    CHECK(rate == RATE);
+
+    Counts sum = { 0, 0, 0, 0 };
+    char line[4096];
+    bool mapped = false;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strcmp(line, "MAPPED_LIBRARIES:\n") == 0) {
+            mapped = true;
+            break;
+        }
+        if (line[0] == '\n')
+            continue;
+        Counts c;
+        int used = 0;
+        CHECK(sscanf(line, "%" SCNd64 ": %" SCNd64 " [%" SCNd64 ": %" SCNd64 "] @%n",
+            &c.inuseCount, &c.inuseBytes, &c.allocCount, &c.allocBytes, &used) == 4);
+        // at least one frame, in hex
+        CHECK(strncmp(line + used, " 0x", 3) == 0);
+        CHECK(c.inuseCount >= 0 && c.inuseCount <= c.allocCount && c.inuseBytes <= c.allocBytes);
+        sum.inuseCount += c.inuseCount;
+        sum.inuseBytes += c.inuseBytes;
+        sum.allocCount += c.allocCount;
+        sum.allocBytes += c.allocBytes;
+    }
+    CHECK(mapped);
+    CHECK(fgets(line, sizeof(line), fp) != NULL);
+    fclose(fp);
+    CHECK(memcmp(&sum, &total, sizeof(Counts)) == 0);
+    return total;
+}
+
+static int64_t CountSampled(void** objects) {
+    int64_t n = 0;
+    for (int i = 0; i < OBJECTS; ++i) {
+        if (objects[i] && BLOCKSIZE_SAMPLED(*(BlockSize*) ((uint8_t*) objects[i] - BLOCK_HEADER_SIZE)))
+            n++;
+    }
+    return n;
+}
+
+static void* objects[OBJECTS];
+
+int main(void) {
+    CHECK(yprofile_start(RATE) == 0);
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = ymalloc(OBJECT_SIZE);
+        CHECK(objects[i] != NULL);
+    }
+
+    // one sample every RATE bytes on average, each counted with its own size
+    CHECK(yprofile_dump(PATH) == 0);
+    Counts c = ReadProfile(PATH);
+    int64_t expected = (int64_t) OBJECTS * OBJECT_SIZE / RATE;
+    CHECK(c.allocCount > expected * 8 / 10 && c.allocCount < expected * 12 / 10);
+    CHECK(c.inuseCount == c.allocCount && c.inuseCount == CountSampled(objects));
+    CHECK(c.inuseBytes == c.inuseCount * OBJECT_SIZE && c.allocBytes == c.inuseBytes);
+
+    // frees only take away from the in use counts
+    for (int i = 0; i < OBJECTS; i += 2) {
+        yfree(objects[i]);
+        objects[i] = NULL;
+    }
+    CHECK(yprofile_dump(PATH) == 0);
+    Counts freed = ReadProfile(PATH);
+    CHECK(freed.inuseCount == CountSampled(objects));
+    CHECK(freed.inuseCount < c.inuseCount && freed.inuseBytes == freed.inuseCount * OBJECT_SIZE);
+    CHECK(freed.allocCount == c.allocCount && freed.allocBytes == c.allocBytes);
+
+    // a dump from a signal handler writes the same profile
+    unlink(SIGNAL_PATH);
+    CHECK(yprofile_dump_on_signal(SIGUSR1, SIGNAL_PATH) == 0);
+    CHECK(raise(SIGUSR1) == 0);
+    Counts signaled = ReadProfile(SIGNAL_PATH);
+    CHECK(memcmp(&signaled, &freed, sizeof(Counts)) == 0);
+
+    // once stopped, nothing new is sampled, but frees of sampled blocks are still counted
+    yprofile_stop();
+    for (int i = 0; i < 1000; ++i)
+        yfree(ymalloc(OBJECT_SIZE));
+    for (int i = 1; i < OBJECTS; i += 2)
+        yfree(objects[i]);
+    CHECK(yprofile_dump(PATH) == 0);
+    Counts stopped = ReadProfile(PATH);
+    CHECK(stopped.inuseCount == 0 && stopped.inuseBytes == 0);
+    CHECK(stopped.allocCount == c.allocCount);
+
+    unlink(PATH);
+    unlink(SIGNAL_PATH);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define BLOCKS 200
+#define BLOCK_BYTES (3 * 4096)
+// PURGE_TICK_BUDGET in purge.h
+#define TICK_BUDGET 64
+
+static void* blocks[BLOCKS];
+
+// blocks whose whole pages are still resident
+static int Resident(void) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    int resident = 0;
+    for (int i = 0; i < BLOCKS; ++i) {
+        uintptr_t begin = ((uintptr_t) blocks[i] + 64 + pageSize - 1) & ~(pageSize - 1);
+        unsigned char vec = 0;
+        CHECK(mincore((void*) begin, pageSize, &vec) == 0);
+        resident += vec & 1;
+    }
+    return resident;
+}
+
+static void SleepMs(long ms) {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = ms * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+int main(void) {
+    // read when the allocator starts, a tick is due on every check
+    setenv("YMALLOC_DECAY_MS", "1", 1);
+
+    // large free blocks kept apart by small live ones
+    void* spacers[BLOCKS];
+    for (int i = 0; i < BLOCKS; ++i) {
+        blocks[i] = ymalloc(BLOCK_BYTES);
+        CHECK(blocks[i] != NULL);
+        memset(blocks[i], 0xA5, BLOCK_BYTES);
+        spacers[i] = ymalloc(64);
+    }
+    for (int i = 0; i < BLOCKS; ++i)
+        yfree(blocks[i]);
+
+    // a tick looks at a bounded number of blocks, later ticks carry on until every expired block is purged
+    SleepMs(20);
+    int before = Resident();
+    yheap_purge_tick();
+    int after = Resident();
+    CHECK(before - after <= TICK_BUDGET);
+    for (int i = 0; i < BLOCKS / TICK_BUDGET + 2 && after != 0; ++i) {
+        yheap_purge_tick();
+        after = Resident();
+    }
+    CHECK(after == 0);
+
+    // purged blocks read as zero
+    char* p = ycalloc(1, BLOCK_BYTES);
+    CHECK(p != NULL);
+    for (size_t i = 0; i < BLOCK_BYTES; ++i)
+        CHECK(p[i] == 0);
+    yfree(p);
+    for (int i = 0; i < BLOCKS; ++i)
+        yfree(spacers[i]);
+    return 0;
+}
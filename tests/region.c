@@ -0,0 +1,111 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// the heap can only be put in a region before the first allocation, so each case runs in a child
+
+#define REGION_SIZE (256 * 1024)
+#define BUFFER_SIZE (1024 * 1024)
+#define GROW_STEP (64 * 1024)
+
+static _Alignas(64) uint8_t buffer[BUFFER_SIZE];
+
+static void RunChild(void (*step)(void)) {
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        step();
+        exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void CheckInside(void* ptr, size_t size, size_t len) {
+    CHECK((uint8_t*) ptr >= buffer && (uint8_t*) ptr + size <= buffer + len);
+}
+
+// allocates until the heap runs out, checking every block, returns the bytes allocated
+static size_t Exhaust(size_t len) {
+    size_t total = 0;
+    for (size_t i = 0; ; ++i) {
+        size_t size = 64 + (i * 312) % 4000;
+        uint8_t* ptr = ymalloc(size);
+        if (ptr == NULL)
+            break;
+        CheckInside(ptr, size, len);
+        memset(ptr, 0x77, size);
+        total += size;
+    }
+    return total;
+}
+
+static void FixedRegion(void) {
+    // old data in the region must not leak through ycalloc
+    memset(buffer, 0xAA, REGION_SIZE);
+    void* brk = sbrk(0);
+    CHECK(yheap_init_region(buffer, REGION_SIZE) == 0);
+
+    uint8_t* zeroed = ycalloc(1, 5000);
+    CHECK(zeroed != NULL);
+    CheckInside(zeroed, 5000, REGION_SIZE);
+    for (size_t i = 0; i < 5000; ++i)
+        CHECK(zeroed[i] == 0);
+    CHECK(yheap_init_region(buffer, REGION_SIZE) == -1);
+
+    // without a grow callback, running out returns NULL
+    size_t total = Exhaust(REGION_SIZE);
+    CHECK(total > REGION_SIZE / 2);
+    CHECK(ymalloc(REGION_SIZE) == NULL);
+    CHECK(yaligned_alloc(4096, 8192) == NULL);
+    CHECK(HeapBegin() == buffer && (uint8_t*) HeapEnd() <= buffer + REGION_SIZE);
+    // and no memory came from the data segment
+    CHECK(sbrk(0) == brk);
+}
+
+static size_t regionLen = GROW_STEP;
+static int growCalls = 0;
+
+// hands out more of the buffer, contiguous with what the heap has so far
+static size_t GrowRegion(void* end, size_t size, void* arg) {
+    CHECK(arg == &regionLen);
+    CHECK(end == buffer + regionLen);
+    growCalls++;
+    size_t added = (size + GROW_STEP - 1) / GROW_STEP * GROW_STEP;
+    if (added > BUFFER_SIZE - regionLen)
+        return 0;
+    regionLen += added;
+    return added;
+}
+
+static void GrowingRegion(void) {
+    void* brk = sbrk(0);
+    CHECK(yheap_init_region(buffer, GROW_STEP) == 0);
+    yheap_set_grow_callback(GrowRegion, &regionLen);
+
+    // a block larger than the first region fits once the callback extended it
+    uint8_t* big = ymalloc(3 * GROW_STEP);
+    CHECK(big != NULL);
+    CHECK(growCalls >= 1);
+    CheckInside(big, 3 * GROW_STEP, regionLen);
+    memset(big, 0x55, 3 * GROW_STEP);
+
+    size_t total = Exhaust(BUFFER_SIZE);
+    CHECK(total > BUFFER_SIZE / 2);
+    CHECK(regionLen > BUFFER_SIZE - GROW_STEP);
+    CHECK(HeapBegin() == buffer && (uint8_t*) HeapEnd() <= buffer + regionLen);
+    for (size_t i = 0; i < 3 * GROW_STEP; ++i)
+        CHECK(big[i] == 0x55);
+    CHECK(sbrk(0) == brk);
+}
+
+int main(void) {
+    RunChild(FixedRegion);
+    RunChild(GrowingRegion);
+    return 0;
+}
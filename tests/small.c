@@ -0,0 +1,55 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_OBJECTS 2000
+#define PROFILE_PATH "/tmp/ymalloc_test_small.heap"
+
+static void* objs[NUM_OBJECTS];
+static size_t sizes[NUM_OBJECTS];
+
+int main(void) {
+    // every size and class boundary, interleaved with plain heap allocations that shift the carve base
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < NUM_OBJECTS; ++i) {
+            sizes[i] = 1 + (size_t) (i * 7 + round) % YMALLOC_SMALL_MAX;
+            objs[i] = ymalloc_small(sizes[i]);
+            CHECK(objs[i] != NULL);
+            CHECK(((uintptr_t) objs[i] & 15) == 0);
+            memset(objs[i], i & 0xFF, sizes[i]);
+            if (i % 50 == 0)
+                yfree(ymalloc(8 + i % 64));
+        }
+        for (int i = 0; i < NUM_OBJECTS; ++i) {
+            for (size_t j = 0; j < sizes[i]; ++j)
+                CHECK(((uint8_t*) objs[i])[j] == (i & 0xFF));
+            // cached objects can go back either way
+            if (i % 3 == 0)
+                yfree(objs[i]);
+            else
+                yfree_small(objs[i], sizes[i]);
+        }
+    }
+
+    // sample (almost) every batch, each sampled object must be reported freed, even through yfree_small
+    CHECK(yprofile_start(1) == 0);
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < NUM_OBJECTS; ++i)
+            objs[i] = ymalloc_small(48);
+        for (int i = 0; i < NUM_OBJECTS; ++i)
+            yfree_small(objs[i], 48);
+    }
+    CHECK(yprofile_dump(PROFILE_PATH) == 0);
+    FILE* fp = fopen(PROFILE_PATH, "r");
+    CHECK(fp != NULL);
+    long inuseCount = -1, inuseBytes = -1, allocCount = 0;
+    CHECK(fscanf(fp, "heap profile: %ld: %ld [%ld:", &inuseCount, &inuseBytes, &allocCount) == 3);
+    fclose(fp);
+    unlink(PROFILE_PATH);
+    CHECK(allocCount > 0);
+    CHECK(inuseCount == 0 && inuseBytes == 0);
+    return 0;
+}
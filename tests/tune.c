@@ -0,0 +1,86 @@
+#include "ymalloc.h"
+#include "tune.h"
+#include "purge.h"
+#include "check.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH "/tmp/ymalloc_test_tune.conf"
+
+static void WriteConfig(const char* text) {
+    FILE* fp = fopen(PATH, "w");
+    CHECK(fp != NULL);
+    CHECK(fputs(text, fp) >= 0);
+    CHECK(fclose(fp) == 0);
+}
+
+static size_t HeapBytes(void) {
+    return (size_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin());
+}
+
+static size_t BlockBytes(void* ptr) {
+    CHECK(ptr != NULL);
+    return BLOCKSIZE_BYTES(*(BlockSize*) ((uint8_t*) ptr - BLOCK_HEADER_SIZE));
+}
+
+int main(void) {
+    CHECK(ytune_load("/nonexistent/ymalloc.conf") == -1);
+
+    // classes that aren't increasing multiples of the alignment within the table are skipped,
+    // so are comments, unknown keys and keys without values
+    WriteConfig(
+        "# written by the tune test\n"
+        "classes 48 64 100 96 128 1000 1024 24 70000\n"
+        "heap_init_size 100001\n"
+        "heap_grow_min 200003\n"
+        "decay_ms 250\n"
+        "\n"
+        "bogus 1 2 3\n"
+        "heap_init_size\n"
+        "classes\n"
+        "# decay_ms 7\n");
+    CHECK(ytune_load(PATH) == 0);
+    CHECK(heapInitSize == 100008);
+    CHECK(heapGrowMin == 200008);
+    CHECK(purgeDecayMs == 250);
+    CHECK(tuneMaxClass == 1024);
+    CHECK(TUNE_SIZE_CLASS(8) == 48);
+    CHECK(TUNE_SIZE_CLASS(48) == 48);
+    CHECK(TUNE_SIZE_CLASS(56) == 64);
+    CHECK(TUNE_SIZE_CLASS(72) == 96);
+    CHECK(TUNE_SIZE_CLASS(104) == 128);
+    CHECK(TUNE_SIZE_CLASS(136) == 1000);
+    CHECK(TUNE_SIZE_CLASS(1000) == 1000);
+    CHECK(TUNE_SIZE_CLASS(1008) == 1024);
+    CHECK(TUNE_SIZE_CLASS(1032) == 1032);
+
+    // the first heap has the configured size, and growing takes at least the configured step
+    void* first = ymalloc(50);
+    CHECK(HeapBytes() == heapInitSize + BLOCK_AUXILIARY_SIZE);
+    size_t before = HeapBytes();
+    void* big = ymalloc(heapInitSize);
+    CHECK(big != NULL);
+    CHECK(HeapBytes() - before == heapGrowMin + BLOCK_AUXILIARY_SIZE);
+
+    // allocations are rounded up to their class
+    CHECK(BlockBytes(first) == 64);
+    CHECK(BlockBytes(ycalloc(3, 30)) == 96);
+    void* moved = yrealloc(ymalloc(100), 900);
+    CHECK(BlockBytes(moved) == 1000);
+    CHECK(BlockBytes(ymalloc(1025)) == 1032);
+
+    // a later config replaces the classes, sizes past the new largest class are no longer rounded
+    WriteConfig("classes 32 256\n");
+    CHECK(ytune_load(PATH) == 0);
+    CHECK(tuneMaxClass == 256);
+    CHECK(TUNE_SIZE_CLASS(40) == 256);
+    CHECK(TUNE_SIZE_CLASS(1000) == 1000);
+    CHECK(heapGrowMin == 200008 && purgeDecayMs == 250);
+    CHECK(BlockBytes(ymalloc(100)) == 256);
+    CHECK(BlockBytes(ymalloc(500)) == 504);
+
+    unlink(PATH);
+    return 0;
+}
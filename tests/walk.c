@@ -0,0 +1,183 @@
+#include "ymalloc.h"
+#include "check.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PATH "/tmp/ymalloc_test_walk.snap"
+#define FORK_PATH "/tmp/ymalloc_test_walk_fork.snap"
+#define MAX_BLOCKS 1024
+
+// the layout written by yheap_snapshot
+typedef struct {
+    char magic[8];
+    uint64_t heapBase;
+    uint64_t heapSize;
+    uint64_t blockCount;
+    uint64_t freeCount;
+    uint32_t freeIndexKind;
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t depth;
+    uint32_t reserved;
+} SnapshotFreeEntry;
+
+typedef struct {
+    uint8_t* payload;
+    size_t size;
+    int isFree;
+} Block;
+
+typedef struct {
+    Block blocks[MAX_BLOCKS];
+    size_t count;
+    size_t freeCount;
+    size_t stopAfter;
+} Walk;
+
+static int RecordBlock(void* payload, size_t size, int isFree, void* arg) {
+    Walk* walk = arg;
+    CHECK(walk->count < MAX_BLOCKS);
+    walk->blocks[walk->count++] = (Block) { payload, size, isFree };
+    if (isFree)
+        walk->freeCount++;
+    return walk->count == walk->stopAfter ? 7 : 0;
+}
+
+static Walk walk;
+
+// walks the whole heap, checking the blocks tile it
+static void WalkHeap(void) {
+    memset(&walk, 0, sizeof(walk));
+    CHECK(yheap_walk(RecordBlock, &walk) == 0);
+    CHECK(walk.count > 0);
+    uint8_t* expected = (uint8_t*) HeapBegin() + BLOCK_HEADER_SIZE;
+    for (size_t i = 0; i < walk.count; ++i) {
+        Block* b = &walk.blocks[i];
+        CHECK(b->payload == expected);
+        CHECK(b->size == BLOCKSIZE_BYTES(*(BlockSize*) (b->payload - BLOCK_HEADER_SIZE)));
+        // free neighbours are always merged
+        CHECK(i == 0 || !(b->isFree && walk.blocks[i - 1].isFree));
+        expected += b->size + BLOCK_AUXILIARY_SIZE;
+    }
+    CHECK(expected - BLOCK_HEADER_SIZE == (uint8_t*) HeapEnd());
+}
+
+static Block* FindBlock(void* payload) {
+    for (size_t i = 0; i < walk.count; ++i) {
+        if (walk.blocks[i].payload == payload)
+            return &walk.blocks[i];
+    }
+    return NULL;
+}
+
+static uint8_t file[1 << 20];
+
+// writes a snapshot and checks it against the last walk
+static size_t CheckSnapshot(const char* path) {
+    CHECK(yheap_snapshot(path) == 0);
+    FILE* fp = fopen(path, "rb");
+    CHECK(fp != NULL);
+    size_t len = fread(file, 1, sizeof(file), fp);
+    fclose(fp);
+
+    SnapshotHeader header;
+    CHECK(len >= sizeof(header));
+    memcpy(&header, file, sizeof(header));
+    CHECK(memcmp(header.magic, "YMSNAP1", 8) == 0);
+    CHECK(header.heapBase == (uint64_t) (uintptr_t) HeapBegin());
+    CHECK(header.heapSize == (uint64_t) ((uint8_t*) HeapEnd() - (uint8_t*) HeapBegin()));
+    CHECK(header.blockCount == walk.count);
+    CHECK(header.freeCount == walk.freeCount);
+    CHECK(header.freeIndexKind == (uint32_t) FreeIndexKind());
+    CHECK(len == sizeof(header) + walk.count * sizeof(BlockSize) + walk.freeCount * sizeof(SnapshotFreeEntry));
+
+    // one block header per block, in address order
+    BlockSize* records = (BlockSize*) (file + sizeof(header));
+    for (size_t i = 0; i < walk.count; ++i) {
+        CHECK(BLOCKSIZE_BYTES(records[i]) == walk.blocks[i].size);
+        CHECK((BLOCKSIZE_USAGE(records[i]) == BLOCK_FREE) == walk.blocks[i].isFree);
+    }
+
+    // every free block is in the index once
+    SnapshotFreeEntry* entries = (SnapshotFreeEntry*) (records + walk.count);
+    int roots = 0;
+    for (size_t i = 0; i < walk.freeCount; ++i) {
+        Block* b = FindBlock((uint8_t*) HeapBegin() + entries[i].offset + BLOCK_HEADER_SIZE);
+        CHECK(b != NULL && b->isFree);
+        for (size_t j = 0; j < i; ++j)
+            CHECK(entries[j].offset != entries[i].offset);
+        if (entries[i].depth == 0)
+            roots++;
+    }
+    CHECK(header.freeIndexKind != 0 || roots == 1);
+    return len;
+}
+
+static uint8_t copy[1 << 20];
+
+int main(void) {
+    // used and free blocks of known sizes, each free one between two used ones
+    uint8_t* used[8];
+    for (int i = 0; i < 8; ++i) {
+        used[i] = ymalloc(1000 * (size_t) (i + 1));
+        CHECK(used[i] != NULL);
+    }
+    CHECK(ymalloc(64) != NULL);
+    for (int i = 1; i < 8; i += 2)
+        yfree(used[i]);
+
+    WalkHeap();
+    for (int i = 0; i < 8; ++i) {
+        Block* b = FindBlock(used[i]);
+        CHECK(b != NULL);
+        CHECK(b->isFree == (i % 2 == 1));
+        CHECK(b->size == PAYLOAD_ALIGN(1000 * (size_t) (i + 1)));
+    }
+    CHECK(walk.freeCount >= 4);
+
+    // a nonzero callback result stops the walk and is returned
+    Walk partial;
+    memset(&partial, 0, sizeof(partial));
+    partial.stopAfter = 2;
+    CHECK(yheap_walk(RecordBlock, &partial) == 7);
+    CHECK(partial.count == 2);
+
+    size_t len = CheckSnapshot(PATH);
+    memcpy(copy, file, len);
+
+    // the forked snapshot is of the heap at the time of the fork, later changes don't show up in it
+    pid_t pid = yheap_snapshot_fork(FORK_PATH);
+    CHECK(pid > 0);
+    yfree(used[2]);
+    yfree(used[4]);
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    FILE* fp = fopen(FORK_PATH, "rb");
+    CHECK(fp != NULL);
+    CHECK(fread(file, 1, sizeof(file), fp) == len);
+    fclose(fp);
+    CHECK(memcmp(file, copy, len) == 0);
+
+    // while a new snapshot sees the blocks from 1 to 5 merged
+    WalkHeap();
+    Block* merged = FindBlock(used[1]);
+    CHECK(merged != NULL && merged->isFree);
+    CHECK(merged->payload + merged->size + BLOCK_AUXILIARY_SIZE == used[6]);
+    for (int i = 2; i < 6; ++i)
+        CHECK(FindBlock(used[i]) == NULL);
+    CheckSnapshot(PATH);
+
+    // a path that can't be opened fails
+    CHECK(yheap_snapshot("/nonexistent/ymalloc.snap") == -1);
+
+    unlink(PATH);
+    unlink(FORK_PATH);
+    return 0;
+}
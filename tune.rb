@@ -0,0 +1,125 @@
+#!/usr/bin/env ruby
+
+# reads a tuning profile written by ytune_dump (or YMALLOC_TUNE_PROFILE) and prints a config for YMALLOC_CONFIG
+# size classes are chosen to waste the fewest bytes for the profiled sizes (dynamic programming over the histogram)
+
+filename = ARGV[0]
+if filename.nil?
+    puts "Usage: tune.rb <profilefile> [numclasses]"
+    exit(1)
+end
+
+NUM_CLASSES = (ARGV[1] || 32).to_i
+MAX_CANDIDATES = 512
+PAGE_SIZE = 4096
+MIN_INIT_SIZE = 64 * 1024
+MAX_INIT_SIZE = 64 * 1024 * 1024
+MIN_GROW_SIZE = 64 * 1024
+MAX_GROW_SIZE = 16 * 1024 * 1024
+MIN_DECAY_MS = 1000
+MAX_DECAY_MS = 60000
+
+sizes = Hash.new(0)
+lifetimes = {}
+largelifetimes = {}
+peaklive = 0
+grows = 0
+growbytes = 0
+File.foreach(filename) { |line|
+    next if line.start_with?("#")
+    key, *values = line.split
+    values = values.map(&:to_i)
+    case key
+    when "size" then sizes[values[0]] += values[1]
+    when "peak_live" then peaklive = values[0]
+    when "grows" then grows, growbytes = values
+    when "lifetime"
+        lifetimes[values[0]] = values[1]
+        largelifetimes[values[0]] = values[2]
+    end
+}
+if sizes.empty?
+    puts "ERROR: #{filename} has no allocations"
+    exit(1)
+end
+
+def roundup(x, multiple)
+    (x + multiple - 1) / multiple * multiple
+end
+
+# too many distinct sizes make the search slow, merge neighbours by rounding up to a coarser granularity
+granularity = 8
+candidates = sizes
+while candidates.size > MAX_CANDIDATES
+    granularity *= 2
+    candidates = Hash.new(0)
+    sizes.each { |size, count| candidates[roundup(size, granularity)] += count }
+end
+points = candidates.keys.sort
+counts = points.map { |size| candidates[size] }
+n = points.size
+k = [NUM_CLASSES, n].min
+
+# prefix sums, so the waste of rounding sizes i..j up to size j is a constant time lookup
+prefixcount = [0]
+prefixbytes = [0]
+n.times { |i|
+    prefixcount.push(prefixcount[-1] + counts[i])
+    prefixbytes.push(prefixbytes[-1] + counts[i] * points[i])
+}
+waste = lambda { |i, j| points[j] * (prefixcount[j+1] - prefixcount[i]) - (prefixbytes[j+1] - prefixbytes[i]) }
+
+# best[c][j] is the least waste covering sizes 0..j with c classes, the largest of which is size j
+infinity = Float::INFINITY
+best = Array.new(k + 1) { Array.new(n, infinity) }
+choice = Array.new(k + 1) { Array.new(n, 0) }
+n.times { |j| best[1][j] = waste.call(0, j) }
+(2..k).each { |c|
+    (c-1...n).each { |j|
+        (c-2...j).each { |i|
+            cost = best[c-1][i] + waste.call(i+1, j)
+            if cost < best[c][j]
+                best[c][j] = cost
+                choice[c][j] = i
+            end
+        }
+    }
+}
+classes = []
+j = n - 1
+k.downto(1) { |c|
+    classes.unshift(points[j])
+    j = choice[c][j]
+}
+
+requested = prefixbytes[n]
+puts "# written by tune.rb from #{File.basename(filename)}"
+puts "# #{classes.size} classes waste #{best[k][n-1]} of #{requested} requested bytes (#{(100.0 * best[k][n-1] / requested).round(2)}%)"
+puts "classes #{classes.join(" ")}"
+
+# start with room for the peak live data, so the heap rarely grows
+initsize = roundup(peaklive, MIN_INIT_SIZE).clamp(MIN_INIT_SIZE, MAX_INIT_SIZE)
+puts "heap_init_size #{initsize}"
+
+# many small grows are many syscalls, grow in larger steps instead
+if grows > 16 && growbytes / grows < MIN_GROW_SIZE
+    puts "heap_grow_min #{roundup(peaklive / 16, PAGE_SIZE).clamp(MIN_GROW_SIZE, MAX_GROW_SIZE)}"
+end
+
+# keep free pages of large allocations around for about as long as most large allocations live,
+# since that is roughly when the memory is asked for again
+largetotal = largelifetimes.values.sum
+if largetotal > 0
+    seen = 0
+    bucket = largelifetimes.keys.sort.find { |b| (seen += largelifetimes[b]) >= largetotal * 0.9 }
+    decay = (2 * (2 << bucket) / 1000000).clamp(MIN_DECAY_MS, MAX_DECAY_MS)
+    puts "decay_ms #{decay}"
+end
+
+total = lifetimes.values.sum
+if total > 0
+    puts "# lifetimes:"
+    lifetimes.keys.sort.each { |b|
+        puts "#   %10d - %-10d ns %d" % [1 << b, (2 << b) - 1, lifetimes[b]]
+    }
+end